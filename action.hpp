@@ -2,6 +2,7 @@
 #define _ACTION_HPP
 
 #include <common.hpp>
+#include <cstdint>
 
 /**
  * \brief The actions the dispatcher can perform.
@@ -13,11 +14,14 @@ enum class action {
 	tx,
 	configure_qswitch,
 	configure_node,
+	tx_batch,
+	rx_replay,
 	
 	// Internal
 	rx,
 	simulator_request,
 	simulator_response,
+	tx_expired,
 	
 	_COUNT
 };
@@ -44,14 +48,17 @@ struct _action {
  * 
  * \warning Order must correspond to action.
  */
-constexpr _action _actions[7] = {
+constexpr _action _actions[10] = {
 		DECLARE_ACTION("configure_detector"),
 		DECLARE_ACTION("tx"),
 		DECLARE_ACTION("configure_qswitch"),
 		DECLARE_ACTION("configure_node"),
+		DECLARE_ACTION("tx_batch"),
+		DECLARE_ACTION("rx_replay"),
 		DECLARE_ACTION("rx"),
 		DECLARE_ACTION("simulator_request"),
 		DECLARE_ACTION("simulator_response"),
+		DECLARE_ACTION("tx_expired"),
 };
 
 static_assert(ARRAY_LENGTH(_actions) == enum_value<action>(action::_COUNT),
@@ -109,4 +116,157 @@ template <class T> constexpr T& _action_str_max_impl(T* begin, T* end) {
 constexpr std::size_t _action_str_max_size = _action_str_max_impl(_actions,
 		&_actions[sizeof(_actions)/sizeof(_actions[0]) - 1]).size;
 
+/**
+ * \brief The number of slots of the perfect hash table of action strings.
+ * 
+ * This must be a power of two. The more slots per action, the sooner a seed that maps
+ * every action to its own slot is found at compile time.
+ */
+#define ACTION_HASH_TABLE_SIZE 64
+
+/**
+ * \brief The number of seeds tried at compile time before giving up on a perfect hash.
+ */
+#define ACTION_HASH_MAX_SEED 256
+
+static_assert((ACTION_HASH_TABLE_SIZE & (ACTION_HASH_TABLE_SIZE - 1)) == 0,
+		"ACTION_HASH_TABLE_SIZE must be a power of two");
+
+static_assert(ACTION_HASH_TABLE_SIZE >= enum_value<action>(action::_COUNT),
+		"ACTION_HASH_TABLE_SIZE is too small");
+
+/**
+ * \brief Seeded FNV-1a hash of size characters of str.
+ * 
+ * This is usable at compile time, and compiles to a loop for runtime use.
+ */
+constexpr std::uint32_t _action_hash(const char* const str,
+		const std::size_t size,
+		const std::uint32_t hash) {
+	return (size == 0
+		? hash
+		: _action_hash(str + 1, size - 1, (hash ^ (unsigned char)*str) * 16777619U));
+}
+
+/**
+ * \brief The slot of size characters of str for a seed.
+ */
+constexpr std::size_t _action_slot(const char* const str,
+		const std::size_t size,
+		const std::uint32_t seed) {
+	return _action_hash(str, size, 2166136261U ^ seed) & (ACTION_HASH_TABLE_SIZE - 1);
+}
+
+/**
+ * \brief Whether action i shares its slot with any action before j.
+ */
+constexpr bool _action_slot_shared(const std::uint32_t seed,
+		const std::size_t i,
+		const std::size_t j) {
+	return (j == i
+		? false
+		: (_action_slot(_actions[i].str, _actions[i].size, seed) ==
+				_action_slot(_actions[j].str, _actions[j].size, seed) ||
+				_action_slot_shared(seed, i, j + 1)));
+}
+
+/**
+ * \brief Whether any action from i on shares its slot with an earlier action.
+ */
+constexpr bool _action_slots_collide(const std::uint32_t seed, const std::size_t i) {
+	return (i == ARRAY_LENGTH(_actions)
+		? false
+		: (_action_slot_shared(seed, i, 0) || _action_slots_collide(seed, i + 1)));
+}
+
+/**
+ * \brief Return the first seed from seed on that maps every action to its own slot.
+ */
+constexpr std::uint32_t _action_find_seed(const std::uint32_t seed) {
+	return ((seed == ACTION_HASH_MAX_SEED || !_action_slots_collide(seed, 0))
+		? seed
+		: _action_find_seed(seed + 1));
+}
+
+/**
+ * \brief The seed of the perfect hash of action strings.
+ */
+constexpr std::uint32_t _action_hash_seed = _action_find_seed(0);
+
+static_assert(_action_hash_seed != ACTION_HASH_MAX_SEED,
+		"No perfect hash of the action strings found, raise ACTION_HASH_TABLE_SIZE");
+
+/**
+ * \brief Return the action whose string maps to a slot, starting the search at action i,
+ * or action::_COUNT if the slot is empty.
+ */
+constexpr std::uint8_t _action_in_slot(const std::size_t slot, const std::size_t i) {
+	return (i == ARRAY_LENGTH(_actions)
+		? (std::uint8_t)action::_COUNT
+		: (_action_slot(_actions[i].str, _actions[i].size, _action_hash_seed) == slot
+				? (std::uint8_t)i
+				: _action_in_slot(slot, i + 1)));
+}
+
+/**
+ * \brief A compile time sequence of indices, like C++14 std::index_sequence.
+ */
+template <std::size_t... I> struct _index_sequence {
+};
+
+/**
+ * \brief Generate _index_sequence<0, ..., N-1>.
+ */
+template <std::size_t N, std::size_t... I> struct _make_index_sequence
+		: _make_index_sequence<N - 1, N - 1, I...> {
+};
+
+/**
+ * \brief Generate _index_sequence<0, ..., N-1>.
+ */
+template <std::size_t... I> struct _make_index_sequence<0, I...> {
+	typedef _index_sequence<I...> type;
+};
+
+/**
+ * \brief The perfect hash table from slot to action.
+ */
+struct _action_table {
+	/**
+	 * \brief The action of each slot, or action::_COUNT for an empty slot.
+	 */
+	std::uint8_t slots[ACTION_HASH_TABLE_SIZE];
+};
+
+/**
+ * \brief Generate the perfect hash table from slot to action.
+ */
+template <std::size_t... S> constexpr _action_table _make_action_table(_index_sequence<S...>) {
+	return _action_table{{_action_in_slot(S, 0)...}};
+}
+
+/**
+ * \brief The perfect hash table from slot to action, generated from _actions[].
+ */
+constexpr _action_table _action_slots =
+		_make_action_table(_make_index_sequence<ACTION_HASH_TABLE_SIZE>::type());
+
+/**
+ * \brief Return the action of size characters of str, or action::_COUNT if there is no
+ * such action.
+ * 
+ * This costs a hash and a single comparison, however many actions there are.
+ */
+inline action action_from_str(const char* const str, const std::size_t size) {
+	const std::uint8_t idx = _action_slots.slots[_action_slot(str, size, _action_hash_seed)];
+	
+	if(idx == enum_value<action>(action::_COUNT) ||
+			_actions[idx].size != size ||
+			memcmp(_actions[idx].str, str, size) != 0) {
+		return action::_COUNT;
+	}
+	
+	return static_cast<action>(idx);
+}
+
 #endif
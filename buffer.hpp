@@ -3,15 +3,37 @@
 
 #include <common.hpp>
 #include "action.hpp"
+#include "fair_queue.hpp"
+#include "idle_strategy.hpp"
+#include "model/node.hpp"
+#include <atomic>
 #include <condition_variable>
+#include <memory>
 #include <mutex>
 #include <queue>
+#include <string>
+#include <vector>
 #include <rapidjson/document.h>
+#include <rapidjson/internal/itoa.h>
 #include <rapidjson/stringbuffer.h>
 #include <rapidjson/writer.h>
+#include <zmq.hpp>
+
+/**
+ * \brief The size of the JSON a push_message holds within itself.
+ * 
+ * This fits {"result":N,"sequence":S} for any 64 bit N and S along with the null
+ * terminator, larger JSON such as an error is allocated.
+ * 
+ * \note Bytes.
+ */
+#define PUSH_MESSAGE_INLINE_SIZE 64
 
 /**
  * \brief A message to be pushed over a zmq publisher.
+ * 
+ * A measurement result is formatted straight into a buffer within the message, so it
+ * is built without any allocation.
  */
 struct push_message {
  public:
@@ -21,12 +43,38 @@ struct push_message {
 	 * \brief Constructor takes data to encode into json.
 	 */
 	push_message(const std::uint_fast64_t topic, const std::uint_fast64_t result, const std::uint_fast64_t timestamp)
-			:_topic(topic), _timestamp(timestamp) {
-		::rapidjson::Document dom;
-		dom.SetObject();
-		dom.AddMember("result", ::rapidjson::Value(result), dom.GetAllocator());
-		::rapidjson::Writer<::rapidjson::StringBuffer> writer(_jsonBuffer);
-		dom.Accept(writer);
+			:_topic(topic), _timestamp(timestamp), _result(result), _sequence(0), _isError(false) {
+		static const char prefix[] = "{\"result\":";
+		
+		char* p = _json;
+		memcpy(p, prefix, sizeof(prefix) - 1);
+		p = ::rapidjson::internal::u64toa(result, p + sizeof(prefix) - 1);
+		*p++ = '}';
+		*p = '\0';
+		
+		_jsonSize = p - _json;
+	}
+	
+	/**
+	 * \brief Constructor takes an error message to encode into json.
+	 */
+	push_message(const std::uint_fast64_t topic, const char* const error, const std::uint_fast64_t timestamp)
+			:_topic(topic), _timestamp(timestamp), _result(0), _sequence(0), _isError(true), _error(error) {
+		// Errors are rare, so they need not avoid allocating
+		::rapidjson::StringBuffer buffer;
+		::rapidjson::Writer<::rapidjson::StringBuffer> writer(buffer);
+		writer.StartObject();
+		writer.Key("error", 5);
+		writer.Bool(true);
+		writer.Key("result", 6);
+		writer.String(error);
+		writer.EndObject();
+		
+		_jsonSize = buffer.GetSize();
+		if(_jsonSize >= PUSH_MESSAGE_INLINE_SIZE) {
+			_jsonHeap.reset(new char[_jsonSize + 1]);
+		}
+		memcpy(json(), buffer.GetString(), _jsonSize + 1);
 	}
 	
 	/**
@@ -38,9 +86,17 @@ struct push_message {
 	 * \brief Move constructor.
 	 */
 	push_message(push_message&& old)
-			: _jsonBuffer(std::move(old._jsonBuffer)) {
-		_topic = old._topic;
-		_timestamp = old._timestamp;
+			: _topic(old._topic),
+			_timestamp(old._timestamp),
+			_result(old._result),
+			_sequence(old._sequence),
+			_isError(old._isError),
+			_error(std::move(old._error)),
+			_jsonSize(old._jsonSize),
+			_jsonHeap(std::move(old._jsonHeap)) {
+		if(!_jsonHeap) {
+			memcpy(_json, old._json, _jsonSize + 1);
+		}
 	}
 	
 	/**
@@ -52,9 +108,17 @@ struct push_message {
 	 * \brief Move assignment operator.
 	 */
 	push_message& operator=(push_message&& old) {
-		_jsonBuffer = std::move(old._jsonBuffer);
 		_topic = old._topic;
 		_timestamp = old._timestamp;
+		_result = old._result;
+		_sequence = old._sequence;
+		_isError = old._isError;
+		_error = std::move(old._error);
+		_jsonSize = old._jsonSize;
+		_jsonHeap = std::move(old._jsonHeap);
+		if(!_jsonHeap) {
+			memcpy(_json, old._json, _jsonSize + 1);
+		}
 		
 		return *this;
 	}
@@ -79,14 +143,14 @@ struct push_message {
 	 * \brief Body of the message encoded in json.
 	 */
 	inline const char* json_data() const {
-		return _jsonBuffer.GetString();
+		return (_jsonHeap ? _jsonHeap.get() : _json);
 	}
 	
 	/**
 	 * \brief Return a the length of the JSON string.
 	 */
 	inline std::size_t get_json_size() const {
-		return _jsonBuffer.GetSize();
+		return _jsonSize;
 	}
 	
 	/**
@@ -95,40 +159,227 @@ struct push_message {
 	inline std::uint_fast64_t timestamp() const {
 		return _timestamp;
 	}
+	
+	/**
+	 * \brief The measurement result, which is 0 for an error.
+	 */
+	inline std::uint_fast64_t result() const {
+		return _result;
+	}
+	
+	/**
+	 * \brief The error message, or null if the message carries a result.
+	 */
+	inline const char* error() const {
+		return (_isError ? _error.c_str() : nullptr);
+	}
+	
+	/**
+	 * \brief The sequence number of the message within its topic.
+	 */
+	inline std::uint64_t sequence() const {
+		return _sequence;
+	}
+	
+	/**
+	 * \brief Set the sequence number of the message within its topic, which is added
+	 * to the JSON.
+	 * 
+	 * \warning Must be called once at most.
+	 */
+	inline void set_sequence(const std::uint64_t sequence) {
+		static const char key[] = ",\"sequence\":";
+		
+		_sequence = sequence;
+		
+		// The key and the number take the place of the closing brace, which follows
+		const std::size_t size = _jsonSize + (sizeof(key) - 1) + 20 + 1;
+		char* json = this->json();
+		if(_jsonHeap || size > PUSH_MESSAGE_INLINE_SIZE) {
+			std::unique_ptr<char[]> heap(new char[size]);
+			memcpy(heap.get(), json, _jsonSize);
+			_jsonHeap = std::move(heap);
+			json = _jsonHeap.get();
+		}
+		
+		char* p = json + _jsonSize - 1;
+		memcpy(p, key, sizeof(key) - 1);
+		p = ::rapidjson::internal::u64toa(sequence, p + sizeof(key) - 1);
+		*p++ = '}';
+		*p = '\0';
+		
+		_jsonSize = p - json;
+	}
 
  private:
 	std::uint_fast64_t _topic;
 	std::uint_fast64_t _timestamp;
+	std::uint_fast64_t _result;
+	std::uint64_t _sequence;
+	bool _isError;
+	
+	/**
+	 * \brief The error message, which is empty for a result.
+	 */
+	std::string _error;
+	
+	/**
+	 * \brief The length of our JSON string.
+	 */
+	std::size_t _jsonSize;
+	
 	/**
-	 * \brief The rapidjson MemoryBuffer that holds our JSON string.
+	 * \brief Our JSON string if it fits.
 	 */
-	::rapidjson::StringBuffer _jsonBuffer;
+	char _json[PUSH_MESSAGE_INLINE_SIZE];
+	
+	/**
+	 * \brief Our JSON string if it does not fit into _json, or null.
+	 */
+	std::unique_ptr<char[]> _jsonHeap;
+	
+	/**
+	 * \brief Return where our JSON string is written to.
+	 */
+	inline char* json() {
+		return (_jsonHeap ? _jsonHeap.get() : _json);
+	}
 };
 
 namespace model {
 	// Forward declaration
-	class node;
 	class channel;
 }
 
+/**
+ * \brief Told once the processor has looked at a request, e.g. to reply to the client
+ * that sent it.
+ */
+struct completion {
+ public:
+	/**
+	 * \brief Destructor.
+	 */
+	virtual ~completion() {
+	}
+	
+	/**
+	 * \brief Called exactly once from a processor thread, with null if the request was
+	 * accepted or with an error message otherwise.
+	 * 
+	 * \warning The error message must be a string literal.
+	 */
+	virtual void complete(const char* const error) = 0;
+};
+
 /**
  * \brief A message to be processed.
  */
 struct interpreted_request {
+ private:
+	/**
+	 * \brief A string of the request.
+	 * 
+	 * Strings within the message are kept as an offset, since zmq keeps small messages
+	 * within the message object itself, which moves along with the request. Anything
+	 * else, e.g. a literal or a string of a DOM, is copied.
+	 */
+	struct _string {
+		/**
+		 * \brief The offset within the message, or -1 if the string is copied.
+		 */
+		std::ptrdiff_t offset;
+		
+		/**
+		 * \brief The copy of a string that is not within the message.
+		 */
+		std::string copy;
+	};
+
  public:
 	/**
-	 * \brief Constructor.
+	 * \brief Constructor takes ownership of the message the request was received in,
+	 * which the strings are meant to point into, so they are not copied.
+	 * 
+	 * If done is given, it is completed once the processor has looked at the request,
+	 * or when the request is destroyed at the latest.
 	 */
 	interpreted_request(::action type,
 			::model::node& from,
+			::zmq::message_t&& message,
 			const char* component,
 			const char* dialect, const char* circuit, const char lineDelimiter,
-			const std::uint_fast64_t txTimestamp)
-			: _type(type), _from(from), _component(component),
-			 _txTimestamp(txTimestamp) {
-		_parameters.push_back(std::string(dialect));
-		_parameters.push_back(std::string(circuit));
-		_parameters.push_back(std::string(1, lineDelimiter));
+			const std::uint_fast64_t txTimestamp,
+			::completion* const done = nullptr)
+			: _type(type), _from(from), _lineDelimiter(lineDelimiter),
+			 _txTimestamp(txTimestamp), _wallDeadline(0), _simDeadline(0), _done(done) {
+		_set(_component, message, component);
+		_set(_parameters[0], message, dialect);
+		_set(_parameters[1], message, circuit);
+		_message.move(&message);
+	}
+	
+	/**
+	 * \brief Copy constructor is disabled.
+	 */
+	interpreted_request(const interpreted_request&) = delete;
+	
+	/**
+	 * \brief Move constructor.
+	 */
+	interpreted_request(interpreted_request&& old)
+			: _type(old._type), _from(old._from), _component(std::move(old._component)),
+			_parameters{std::move(old._parameters[0]), std::move(old._parameters[1])},
+			_lineDelimiter(old._lineDelimiter), _txTimestamp(old._txTimestamp),
+			_wallDeadline(old._wallDeadline), _simDeadline(old._simDeadline),
+			_done(old._done) {
+		_message.move(&old._message);
+		old._done = nullptr;
+	}
+	
+	/**
+	 * \brief Destructor completes the request if nobody has yet.
+	 */
+	~interpreted_request() {
+		complete(nullptr);
+	}
+	
+	/**
+	 * \brief Tell whoever waits for the request that the processor has looked at it,
+	 * see completion::complete().
+	 * 
+	 * Only the first call has an effect.
+	 */
+	inline void complete(const char* const error) {
+		if(_done != nullptr) {
+			::completion* const done = _done;
+			_done = nullptr;
+			done->complete(error);
+		}
+	}
+	
+	/**
+	 * \brief Forget whoever waits for the request without completing it, because the
+	 * caller replies to them itself, e.g. when the request is turned away.
+	 */
+	inline void detach() {
+		_done = nullptr;
+	}
+	
+	/**
+	 * \brief Return the flow the request is queued fairly within, which is its source
+	 * node.
+	 */
+	inline ::model::node::id_t flow() const {
+		return _from.id();
+	}
+	
+	/**
+	 * \brief Return whether the request reconfigures the network, which goes ahead of
+	 * every transmission so it takes effect promptly.
+	 */
+	inline bool priority() const {
+		return _type != ::action::tx;
 	}
 	
 	/**
@@ -146,7 +397,7 @@ struct interpreted_request {
 	}
 	
 	const char* component() const {
-		return _component.c_str();
+		return _get(_component);
 	}
 	
 	/**
@@ -157,32 +408,110 @@ struct interpreted_request {
 	}
 	
 	/**
-	 * \brief \todo
+	 * \brief Set when the request goes stale, as a time of the steady clock in
+	 * nanoseconds and as a simulation time, where 0 means never.
+	 */
+	inline void set_deadline(const std::uint_fast64_t wallDeadline,
+			const std::uint_fast64_t simDeadline) {
+		_wallDeadline = wallDeadline;
+		_simDeadline = simDeadline;
+	}
+	
+	/**
+	 * \brief Return the time of the steady clock the request goes stale at, or 0.
+	 * 
+	 * \note Nanoseconds.
+	 */
+	std::uint_fast64_t wall_deadline() const {
+		return _wallDeadline;
+	}
+	
+	/**
+	 * \brief Return the simulation time the request goes stale at, or 0.
+	 */
+	std::uint_fast64_t sim_deadline() const {
+		return _simDeadline;
+	}
+	
+	/**
+	 * \brief Return the dialect (0), the circuit (1) or the line delimiter (2).
+	 * 
+	 * \warning You must use a template specialized function.
 	 */
 	template <typename T> inline T parameter(const std::size_t index) const;
 
  private:
 	::action _type;
 	::model::node& _from;
-	std::string _component;
-	std::vector<std::string> _parameters;
+	
+	/**
+	 * \brief The message the request was received in.
+	 */
+	::zmq::message_t _message;
+	
+	_string _component;
+	
+	/**
+	 * \brief The dialect and the circuit.
+	 */
+	_string _parameters[2];
+	
+	char _lineDelimiter;
 	std::uint_fast64_t _txTimestamp;
+	
+	/**
+	 * \brief When the request goes stale, see set_deadline().
+	 */
+	std::uint_fast64_t _wallDeadline;
+	std::uint_fast64_t _simDeadline;
+	
+	/**
+	 * \brief Who waits for the request, or null.
+	 */
+	::completion* _done;
+	
+	/**
+	 * \brief Refer to str if it is within message, or copy it otherwise.
+	 */
+	static inline void _set(_string& dst, const ::zmq::message_t& message, const char* const str) {
+		const char* const begin = static_cast<const char*>(message.data());
+		if(str >= begin && str < begin + message.size()) {
+			dst.offset = str - begin;
+		} else {
+			dst.offset = -1;
+			dst.copy = str;
+		}
+	}
+	
+	/**
+	 * \brief Return a string of the request.
+	 */
+	inline const char* _get(const _string& str) const {
+		return (str.offset < 0
+				? str.copy.c_str()
+				: static_cast<const char*>(_message.data()) + str.offset);
+	}
 };
 
 /**
- * \brief \todo
+ * \brief Return the line delimiter.
  */
 template<>
 		inline char interpreted_request::parameter<char>(const std::size_t index) const {
-	return _parameters[index].c_str()[0];
+	assert(index == 2);
+	UNUSED(index);
+	
+	return _lineDelimiter;
 }
 
 /**
- * \brief \todo
+ * \brief Return the dialect or the circuit.
  */
 template <>
 		inline const char* interpreted_request::parameter<const char*>(const std::size_t index) const {
-	return _parameters[index].c_str();
+	assert(index < 2);
+	
+	return _get(_parameters[index]);
 }
 
 /**
@@ -191,8 +520,8 @@ template <>
  
  /** \todo Single producer single consumer may not extend to threaded model */
  
-template <typename T> class buffer {
- private:
+template <typename T, typename Q = std::queue<T>> class buffer {
+ protected:
 	typedef std::unique_lock<std::mutex> lock_t;
 
  public:
@@ -201,7 +530,9 @@ template <typename T> class buffer {
 	 */
 	buffer()
 			: pushWaitNew(0),
-			pushWaitThreshold(0) {
+			pushWaitThreshold(0),
+			capacity(0),
+			queued(0) {
 	}
 	
 	/**
@@ -235,6 +566,20 @@ template <typename T> class buffer {
 		pushWaitThreshold = threshold;
 	}
 	
+	/**
+	 * \brief Set the number of items the queue holds at most when pushed with
+	 * try_push() or try_push_all(), which is 0 by default for no limit.
+	 * 
+	 * push() and push_all() ignore the capacity.
+	 * 
+	 * \note Threadsafe
+	 */
+	inline void set_capacity(const std::size_t capacity) {
+		lock_t lock(queueMutex);
+		
+		this->capacity = capacity;
+	}
+	
 	/**
 	 * \brief Return the number of items in the queue.
 	 * 
@@ -278,6 +623,7 @@ template <typename T> class buffer {
 		// and a call to pop().
 		T item = std::move(const_cast<T&>(queue.front()));
 		queue.pop();
+		queued.store(queue.size(), std::memory_order_relaxed);
 		return item;
 	}
 	
@@ -289,15 +635,34 @@ template <typename T> class buffer {
 	 *
 	 * \note Threadsafe
 	 */
-	inline std::queue<T> pop_all() {
+	inline Q pop_all() {
 		lock_t lock(queueMutex);
 		
-		std::queue<T> returnQueue;
+		Q returnQueue;
 		std::swap(queue, returnQueue);
+		queued.store(0, std::memory_order_relaxed);
 		
 		return returnQueue;
 	}
 	
+	/**
+	 * \brief Pop all the items current within the queue into items, which must be
+	 * empty.
+	 * 
+	 * Unlike pop_all(), this hands our queue over without building a new one, so a
+	 * caller that keeps items around does not allocate a queue for every call.
+	 * 
+	 * \note Threadsafe
+	 */
+	inline void pop_all(Q& items) {
+		assert(items.empty());
+		
+		lock_t lock(queueMutex);
+		
+		std::swap(queue, items);
+		queued.store(0, std::memory_order_relaxed);
+	}
+	
 	/**
 	 * \brief Push some data into the queue.
 	 * 
@@ -307,12 +672,95 @@ template <typename T> class buffer {
 		lock_t lock(queueMutex);
 		
 		queue.push(std::move(item));
+		queued.store(queue.size(), std::memory_order_relaxed);
 		
 		if(pushWaitThreshold > 0 && ++pushWaitNew >= pushWaitThreshold) {
 			pushWaitCV.notify_all();
 		}
 	}
 	
+	/**
+	 * \brief Push all the items of a vector into the queue at once and clear it.
+	 * 
+	 * The lock is taken and waiters are notified once for the whole vector.
+	 * 
+	 * \note Threadsafe
+	 */
+	inline void push_all(std::vector<T>& items) {
+		if(items.empty()) {
+			return;
+		}
+		
+		lock_t lock(queueMutex);
+		
+		for(auto& item : items) {
+			queue.push(std::move(item));
+		}
+		queued.store(queue.size(), std::memory_order_relaxed);
+		
+		pushWaitNew += items.size();
+		if(pushWaitThreshold > 0 && pushWaitNew >= pushWaitThreshold) {
+			pushWaitCV.notify_all();
+		}
+		
+		lock.unlock();
+		items.clear();
+	}
+	
+	/**
+	 * \brief Push an item into the queue unless it is full.
+	 * 
+	 * \returns Whether the item was pushed. If not, the item is left alone.
+	 * 
+	 * \note Threadsafe
+	 */
+	inline bool try_push(T&& item) {
+		lock_t lock(queueMutex);
+		
+		if(capacity != 0 && queue.size() >= capacity) {
+			return false;
+		}
+		
+		queue.push(std::move(item));
+		queued.store(queue.size(), std::memory_order_relaxed);
+		
+		if(pushWaitThreshold > 0 && ++pushWaitNew >= pushWaitThreshold) {
+			pushWaitCV.notify_all();
+		}
+		
+		return true;
+	}
+	
+	/**
+	 * \brief Push all the items of a vector into the queue at once and clear it, unless
+	 * they do not all fit.
+	 * 
+	 * \returns Whether the items were pushed. If not, the items are left alone.
+	 * 
+	 * \note Threadsafe
+	 */
+	inline bool try_push_all(std::vector<T>& items) {
+		lock_t lock(queueMutex);
+		
+		if(capacity != 0 && queue.size() + items.size() > capacity) {
+			return false;
+		}
+		
+		for(auto& item : items) {
+			queue.push(std::move(item));
+		}
+		queued.store(queue.size(), std::memory_order_relaxed);
+		
+		pushWaitNew += items.size();
+		if(pushWaitThreshold > 0 && pushWaitNew >= pushWaitThreshold) {
+			pushWaitCV.notify_all();
+		}
+		
+		lock.unlock();
+		items.clear();
+		return true;
+	}
+	
 	/**
 	 * \brief Block up to a specified amount of time waiting for an item
 	 * to be pushed into the queue.
@@ -343,6 +791,45 @@ template <typename T> class buffer {
 		return false;
 	}
 	
+	/**
+	 * \brief Wait up to a specified amount of time like push_wait(), spinning or
+	 * parking as the idle strategy says.
+	 * 
+	 * A spinning wait reads the number of items, which every push stores, so unlike
+	 * a parked wait it cannot miss a push. Either way the count of new items starts
+	 * afresh once the wait succeeds.
+	 * 
+	 * \note Threadsafe
+	 */
+	inline bool push_wait(const idle_strategy& idle, const std::size_t milliseconds) {
+		if(idle.mode() == idle_mode::park) {
+			return push_wait(milliseconds);
+		}
+		
+		std::size_t threshold;
+		{
+			lock_t lock(queueMutex);
+			
+			threshold = pushWaitThreshold;
+		}
+		
+		// Spinning looks at the number of items without taking the lock
+		if(idle.wait(milliseconds,
+				[this, threshold] {
+					return queued.load(std::memory_order_relaxed) >= threshold;
+				},
+				[this] (const std::size_t remaining) {
+					return push_wait(remaining);
+				})) {
+			lock_t lock(queueMutex);
+			
+			pushWaitNew = 0;
+			return true;
+		}
+		
+		return false;
+	}
+	
 	template <std::condition_variable& cv, std::mutex& mutex, const std::size_t milliseconds>
 			bool push_wait() {
 		lock_t lock(mutex);
@@ -361,19 +848,56 @@ template <typename T> class buffer {
 		return false;
 	}
 
- private:
-	std::queue<T> queue;
+ protected:
+	Q queue;
 	std::mutex queueMutex;
 	std::condition_variable pushWaitCV;
 	
 	std::size_t pushWaitNew;
 	std::size_t pushWaitThreshold;
+	
+	/**
+	 * \brief The number of items try_push() fills the queue up to, or 0.
+	 */
+	std::size_t capacity;
+	
+	/**
+	 * \brief The number of items in the queue, which may be read without the lock.
+	 */
+	std::atomic<std::size_t> queued;
 };
 
 /**
  * \brief Buffer of incoming requests (for transmission).
+ * 
+ * Requests are handed out fairly between their source nodes, after every
+ * configuration request, see fair_queue.
  */
-class incomingBuffer_t : public buffer<interpreted_request> {};
+class incomingBuffer_t : public buffer<interpreted_request, fair_queue<interpreted_request>> {
+ public:
+	/**
+	 * \brief Set the number of requests of a source node handed out per turn.
+	 * 
+	 * \note Threadsafe
+	 */
+	inline void set_weight(const ::model::node::id_t node, const std::size_t weight) {
+		lock_t lock(queueMutex);
+		
+		queue.set_weight(node, weight);
+	}
+	
+	/**
+	 * \brief Set the number of requests per turn of the source nodes without a weight
+	 * of their own.
+	 * 
+	 * \note Threadsafe
+	 */
+	inline void set_default_weight(const std::size_t weight) {
+		lock_t lock(queueMutex);
+		
+		queue.set_default_weight(weight);
+	}
+};
 
 /**
  * \brief Buffer of outgoing replies (for transmission).
@@ -17,6 +17,44 @@ template<typename E>
 	return static_cast<typename std::underlying_type<E>::type>(enumerator);
 }
 
+/**
+ * \brief A view of characters owned by someone else.
+ * 
+ * The characters need not be null terminated, so always use size.
+ */
+struct str_view {
+	/**
+	 * \brief Constructor of an empty view.
+	 */
+	constexpr str_view()
+			: data(nullptr), size(0) {
+	}
+	
+	/**
+	 * \brief Constructor takes a pointer to the characters and their number.
+	 */
+	constexpr str_view(const char* const data, const std::size_t size)
+			: data(data), size(size) {
+	}
+	
+	/**
+	 * \brief Return whether the view has the same characters as a size long string.
+	 */
+	inline bool equals(const char* const str, const std::size_t size) const {
+		return (this->size == size && memcmp(data, str, size) == 0);
+	}
+	
+	/**
+	 * \brief The first character.
+	 */
+	const char* data;
+	
+	/**
+	 * \brief The number of characters.
+	 */
+	std::size_t size;
+};
+
 /**
  * \brief \todo
  */
@@ -29,6 +67,10 @@ namespace err_msg {
 	const char _undhcse[] = "unhandled case";
 	const char _zrlngth[] = "zero length";
 	const char _badtype[] = "bad type";
+	const char _unkmthd[] = "unknown method";
+	const char _invldrq[] = "invalid request";
+	const char _svrbusy[] = "busy";
+	const char _expired[] = "deadline exceeded";
 }
 
 #endif
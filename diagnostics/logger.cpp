@@ -6,7 +6,8 @@ namespace diagnostics {
 			isRunning(false),
 			doExit(false),
 			pushWaitNew(0),
-			pushWaitThreshold(0) {
+			pushWaitThreshold(0),
+			sendQueueSize(0) {
 		
 		if(isRealized) {
 			_put_func = &diagnostics::logger::_put;
@@ -59,7 +60,50 @@ namespace diagnostics {
 		(this->*_put_func)(topic, data, size);
 	}
 	
+	void logger::put_binary(const action topic,
+			const void* const data,
+			const std::size_t size) {
+		if(!isRealized) {
+			return;
+		}
+		
+		// Message data is embedded in JSON, which cannot hold raw bytes
+		static const char digits[] = "0123456789abcdef";
+		const unsigned char* const bytes = static_cast<const unsigned char*>(data);
+		std::vector<char> hex(2*size + 2);
+		hex[0] = '"';
+		for(std::size_t i = 0; i < size; i++) {
+			hex[2*i + 1] = digits[bytes[i] >> 4];
+			hex[2*i + 2] = digits[bytes[i] & 0x0F];
+		}
+		hex[2*size + 1] = '"';
+		
+		_put(topic, hex.data(), hex.size());
+	}
+	
 	bool logger::push_wait(const std::size_t milliseconds) {
+		if(idle.mode() != idle_mode::park) {
+			// Like _put(), spinning reads the threshold without the lock
+			if(idle.wait(milliseconds,
+					[this] {
+						return sendQueueSize.load(std::memory_order_relaxed) > pushWaitThreshold;
+					},
+					[this] (const std::size_t remaining) {
+						return park(remaining);
+					})) {
+				lock_t lock(sendQueueMutex);
+				
+				pushWaitNew = 0;
+				return true;
+			}
+			
+			return false;
+		}
+		
+		return park(milliseconds);
+	}
+	
+	bool logger::park(const std::size_t milliseconds) {
 		std::unique_lock<std::mutex> lock(sendQueueMutex);
 		
 		if(sendQueue.size() > pushWaitThreshold ||
@@ -80,6 +124,7 @@ namespace diagnostics {
 		
 		std::queue<message*> returnQueue;
 		std::swap(sendQueue, returnQueue);
+		sendQueueSize.store(0, std::memory_order_relaxed);
 		
 		return returnQueue;
 	}
@@ -98,6 +143,7 @@ namespace diagnostics {
 		// By allocating this message on the heap and storing the pointer, we only need to
 		// do one allocation for the message object until we push this out on the wire.
 		sendQueue.push(new message(topic, (char*)data, size));
+		sendQueueSize.store(sendQueue.size(), std::memory_order_relaxed);
 		
 		// Avoid waking up waiting threads to block again if notify_all() is called.
 		ulock.unlock();
@@ -3,11 +3,13 @@
 
 #include <common.hpp>
 #include "message.hpp"
+#include "../idle_strategy.hpp"
 #include <atomic>
 #include <condition_variable>
 #include <mutex>
 #include <queue>
 #include <thread>
+#include <vector>
 
 namespace diagnostics {
 	/**
@@ -75,6 +77,16 @@ namespace diagnostics {
 				const void* const data,
 				const std::size_t size);
 		
+		/**
+		 * \brief Push binary data into the queue as a JSON string of hex digits or do
+		 * nothing, depending on how the logger has been configured.
+		 * 
+		 * \note Threadsafe.
+		 */
+		void put_binary(const action topic,
+				const void* const data,
+				const std::size_t size);
+		
 		/**
 		 * \brief Set the threshold when a call to push_wait will be successful.
 		 * 
@@ -86,11 +98,23 @@ namespace diagnostics {
 			pushWaitThreshold = threshold;
 		}
 		
+		/**
+		 * \brief Set how the logger thread waits for messages, which is to park by
+		 * default.
+		 * 
+		 * \warning Must be called before start().
+		 */
+		inline void set_idle(const idle_strategy& idle) {
+			this->idle = idle;
+		}
+		
 		/**
 		 * \brief Wait until the push wait threshold is exceeded.
 		 * 
 		 * If the current size of the queue is larger than the threshold, we return
-		 * immediately.
+		 * immediately. Otherwise the thread spins or parks as set_idle() says. Spinning
+		 * reads the size of the queue, which every put stores, and the count of new
+		 * messages starts afresh once the wait succeeds, as it does for park().
 		 * 
 		 * \note Threadsafe
 		 */
@@ -160,6 +184,16 @@ namespace diagnostics {
 		 */
 		std::mutex sendQueueMutex;
 		
+		/**
+		 * \brief The size of the queue, which may be read without the lock.
+		 */
+		std::atomic<std::size_t> sendQueueSize;
+		
+		/**
+		 * \brief How the logger thread waits for messages.
+		 */
+		idle_strategy idle;
+		
 		/**
 		 * \brief The work function that pops items from the queue and logs them.
 		 * 
@@ -173,11 +207,16 @@ namespace diagnostics {
 		 * their own.
 		 * 
 		 * Safe to call when the queue is empty, as it simply returns an empty queue.
-		 *
+		 * 
 		 * \note Threadsafe
 		 */
 		std::queue<message*> pop_all();
 		
+		/**
+		 * \brief Sleep until the push wait threshold is exceeded, see push_wait().
+		 */
+		bool park(const std::size_t milliseconds);
+		
 		/**
 		 * \brief Function pointer to either _put or _put_nothing.
 		 * 
@@ -1,18 +1,25 @@
 #include <common.hpp>
 #include "diagnostics/server.hpp"
 #include "buffer.hpp"
+#include "idle_strategy.hpp"
 #include "net/server.hpp"
 #include "processor.hpp"
 #include <csignal>
+#include <algorithm>
 #include <atomic>
 #include <chrono>
+#include <cstdint>
 #include <fstream>
 #include <iostream>
+#include <stdexcept>
 #include <thread>
+#include <vector>
 #include "boost/program_options.hpp"
 
 #define DEFAULT_RX_SERVER_THREAD_COUNT 1
+#define DEFAULT_RX_SERVER_BATCH_SIZE 1
 #define DEFAULT_TX_SERVER_THREAD_COUNT 1
+#define DEFAULT_INGEST_SERVER_THREAD_COUNT 1
 #define DEFAULT_SABOT_CLIENT_THREAD_COUNT 1
 
 std::sig_atomic_t signal_code = 0;
@@ -27,10 +34,30 @@ int main(int argc, char *argv[]) {
 	std::string loggerEndpoint;
 	std::string rxServerEndpoint;
 	std::size_t rxServerThreadCount(DEFAULT_RX_SERVER_THREAD_COUNT);
+	std::string rxBinaryServerEndpoint;
+	std::size_t rxServerBatchSize(DEFAULT_RX_SERVER_BATCH_SIZE);
+	std::size_t rxServerBatchLatency(0);
+	bool rxServerObservedOnly(false);
+	std::string rxReplayServerEndpoint;
+	std::size_t rxReplayDepth(NET_RX_HISTORY_DEPTH);
 	std::string txServerEndpoint;
 	std::size_t txServerThreadCount(DEFAULT_TX_SERVER_THREAD_COUNT);
-	std::string sabotLocation;
+	bool txServerDirect(false);
+	bool txServerDeferred(false);
+	std::string ingestServerEndpoint;
+	std::size_t ingestServerThreadCount(DEFAULT_INGEST_SERVER_THREAD_COUNT);
+	std::vector<std::string> sabotLocations;
 	std::size_t sabotClientThreadCount(DEFAULT_SABOT_CLIENT_THREAD_COUNT);
+	int sabotDeadline(SIMULATOR_CLIENT_POOL_RECVTO);
+	bool sabotHedging(false);
+	bool sabotBinary(false);
+	std::size_t queueCapacity(0);
+	std::size_t queueNodeCapacity(0);
+	std::uint32_t queueRetryAfter(PROCESSOR_RETRY_AFTER);
+	std::vector<std::string> queueWeights;
+	std::string processorIdle("park");
+	std::string rxServerIdle("park");
+	std::string loggerIdle("park");
 	
 	try {
 		namespace po = boost::program_options;
@@ -42,10 +69,30 @@ int main(int argc, char *argv[]) {
 			("logger,l", po::value<std::string>(&loggerEndpoint), "Logger Server Endpoint")
 			("rs", po::value<std::string>(&rxServerEndpoint)->required(), "Rx Server Endpoint")
 			("rt", po::value<std::size_t>(&rxServerThreadCount), "Rx Server Thread Count")
+			("rb", po::value<std::string>(&rxBinaryServerEndpoint), "Binary Rx Server Endpoint")
+			("rc", po::value<std::size_t>(&rxServerBatchSize), "Rx results of a topic published together")
+			("rl", po::value<std::size_t>(&rxServerBatchLatency), "Rx result batch latency in milliseconds")
+			("ro", po::bool_switch(&rxServerObservedOnly), "Only simulate transmissions whose rx topic is subscribed to")
+			("rr", po::value<std::string>(&rxReplayServerEndpoint), "Rx Replay Server Endpoint")
+			("rd", po::value<std::size_t>(&rxReplayDepth), "Rx results kept per topic for replay")
 			("ts", po::value<std::string>(&txServerEndpoint)->required(), "Tx Server Endpoint")
 			("tt", po::value<std::size_t>(&txServerThreadCount), "Tx Server Thread Count")
-			("s", po::value<std::string>(&sabotLocation)->required(), "Sabot Location")
-			("st", po::value<std::size_t>(&sabotClientThreadCount), "Sabot client Thread Count");
+			("td", po::bool_switch(&txServerDirect), "Handle tx requests without a proxy on a single thread")
+			("ta", po::bool_switch(&txServerDeferred), "Reply to tx requests once their routing has been checked")
+			("is", po::value<std::string>(&ingestServerEndpoint), "Ingest Server Endpoint")
+			("it", po::value<std::size_t>(&ingestServerThreadCount), "Ingest Server Thread Count")
+			("s", po::value<std::vector<std::string> >(&sabotLocations)->multitoken()->required(), "Sabot Location(s)")
+			("st", po::value<std::size_t>(&sabotClientThreadCount), "Sabot client Thread Count")
+			("sd", po::value<int>(&sabotDeadline), "Sabot call deadline in milliseconds, -1 for none")
+			("sh", po::bool_switch(&sabotHedging), "Hedge slow sabot calls to a second sabot location")
+			("sb", po::bool_switch(&sabotBinary), "Negotiate the binary encoding with sabot")
+			("qc", po::value<std::size_t>(&queueCapacity), "Tx requests queued for processing at most, 0 for no limit")
+			("qn", po::value<std::size_t>(&queueNodeCapacity), "Tx requests of a single node queued at most, 0 for no limit")
+			("qr", po::value<std::uint32_t>(&queueRetryAfter), "Milliseconds a client turned away is asked to wait")
+			("qw", po::value<std::vector<std::string> >(&queueWeights)->multitoken(), "Requests of a node processed per turn, as node=weight")
+			("pi", po::value<std::string>(&processorIdle), "How processing threads wait: spin, yield or park")
+			("ri", po::value<std::string>(&rxServerIdle), "How rx threads wait: spin, yield or park")
+			("li", po::value<std::string>(&loggerIdle), "How the logger thread waits: spin, yield or park");
 		
 		po::variables_map vm;
 		po::store(po::parse_command_line(argc, argv, desc), vm);
@@ -65,6 +112,23 @@ int main(int argc, char *argv[]) {
 		exit(-1);
 	}
 	
+	if(txServerDirect && txServerThreadCount > 1) {
+		std::cerr << "--td handles tx requests on a single thread and cannot be combined with --tt greater than 1." << std::endl;
+		exit(-1);
+	}
+	
+	idle_strategy processorIdleStrategy;
+	idle_strategy rxServerIdleStrategy;
+	idle_strategy loggerIdleStrategy;
+	try {
+		processorIdleStrategy = idle_strategy(processorIdle.c_str());
+		rxServerIdleStrategy = idle_strategy(rxServerIdle.c_str());
+		loggerIdleStrategy = idle_strategy(loggerIdle.c_str());
+	} catch(const std::invalid_argument&) {
+		std::cerr << "Idle strategies are spin, yield or park." << std::endl;
+		exit(-1);
+	}
+	
 	// We try to be smart here: if the topology looks like JSON, we send it directly to be
 	// parsed. If it doesn't look like JSON, we see if it is a file that could contain
 	// JSON.
@@ -108,13 +172,36 @@ int main(int argc, char *argv[]) {
 		logger = new diagnostics::server();
 	}
 	
+	logger->set_idle(loggerIdleStrategy);
 	logger->start();
 	
 	// topology
 	model::state state(topology.c_str());
 	
 	// Processor
-	processor worker(logger, sabotLocation.c_str(), state, context);
+	processor worker(logger, sabotLocations, state, context);
+	worker.simulator_balancer().set_deadline(sabotDeadline);
+	worker.simulator_balancer().set_hedging(sabotHedging);
+	worker.simulator_balancer().set_binary(sabotBinary);
+	worker.set_skip_unobserved(rxServerObservedOnly);
+	worker.set_idle(processorIdleStrategy);
+	worker.set_admission(queueCapacity, queueNodeCapacity, queueRetryAfter);
+	for(auto& weight : queueWeights) {
+		try {
+			const std::size_t split = weight.find('=');
+			if(split == std::string::npos) {
+				throw std::invalid_argument(weight);
+			}
+			
+			worker.incoming_buffer().set_weight(std::stoull(weight.substr(0, split)),
+					std::stoull(weight.substr(split + 1)));
+		} catch(const std::exception&) {
+			std::cerr << "Invalid queue weight: " << weight << std::endl;
+			exit(-1);
+		}
+	}
+	// One outgoing buffer per rx thread, set before anything can produce a result
+	worker.set_outgoing_shards(std::max<std::size_t>(rxServerThreadCount, 1));
 	worker.start(sabotClientThreadCount);
 	
 	// Client facing server
@@ -123,6 +210,19 @@ int main(int argc, char *argv[]) {
 							worker,
 							rxServerEndpoint.c_str(), 
 							txServerEndpoint.c_str());
+	frontend.set_direct(txServerDirect);
+	frontend.set_deferred(txServerDeferred);
+	if(ingestServerEndpoint.size() != 0) {
+		frontend.set_ingest(ingestServerEndpoint.c_str(), ingestServerThreadCount);
+	}
+	if(rxBinaryServerEndpoint.size() != 0) {
+		frontend.set_rx_binary(rxBinaryServerEndpoint.c_str());
+	}
+	frontend.set_rx_batch(rxServerBatchSize, rxServerBatchLatency);
+	frontend.set_rx_idle(rxServerIdleStrategy);
+	if(rxReplayServerEndpoint.size() != 0) {
+		frontend.set_rx_replay(rxReplayServerEndpoint.c_str(), rxReplayDepth);
+	}
 	frontend.listen(rxServerThreadCount, txServerThreadCount);
 	
 	// Handle term signal
@@ -141,6 +241,8 @@ int main(int argc, char *argv[]) {
 	frontend.stop();
 	worker.stop();
 	
+	std::cout << "Dropped " << worker.expired_count() << " stale transmissions." << std::endl;
+	
 	if(logger) {
 		delete logger;
 	}
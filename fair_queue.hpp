@@ -0,0 +1,222 @@
+#ifndef _FAIR_QUEUE_HPP
+#define _FAIR_QUEUE_HPP
+
+#include <common.hpp>
+#include <cassert>
+#include <cstdint>
+#include <deque>
+#include <queue>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+
+/**
+ * \brief The number of items a flow without a weight of its own takes per round.
+ */
+#define FAIR_QUEUE_DEFAULT_WEIGHT 1
+
+/**
+ * \brief A queue that shares its output fairly between flows with deficit round-robin,
+ * with a lane of priority items ahead of every flow.
+ * 
+ * Items of the same flow keep their order. Flows with items take turns, and each turn
+ * a flow hands out as many items as its weight, so a flow with many items waiting
+ * cannot starve the others. Priority items are handed out first, in order.
+ * 
+ * T must have a flow() member that returns the flow of an item as an unsigned int and
+ * a priority() member that returns whether it belongs in the priority lane.
+ * 
+ * The interface is the part of std::queue that buffer uses, so it can stand in for it.
+ * 
+ * \warning Not threadsafe.
+ */
+template <typename T> class fair_queue {
+ public:
+	typedef std::uint_fast64_t flow_t;
+
+ private:
+	/**
+	 * \brief The items and the turn of a flow.
+	 */
+	struct flow_state {
+		flow_state()
+				: weight(0),
+				deficit(0) {
+		}
+		
+		/**
+		 * \brief The items of the flow in order.
+		 */
+		std::queue<T> items;
+		
+		/**
+		 * \brief The items the flow hands out per turn, or 0 for the default.
+		 */
+		std::size_t weight;
+		
+		/**
+		 * \brief The items the flow may still hand out in its current turn, which is 0
+		 * between turns.
+		 */
+		std::size_t deficit;
+	};
+
+ public:
+	/**
+	 * \brief Constructor.
+	 */
+	fair_queue()
+			: _size(0),
+			_defaultWeight(FAIR_QUEUE_DEFAULT_WEIGHT) {
+	}
+	
+	/**
+	 * \brief Copy constructor is disabled.
+	 */
+	fair_queue(const fair_queue&) = delete;
+	
+	/**
+	 * \brief Move constructor.
+	 */
+	fair_queue(fair_queue&& old) = default;
+	
+	/**
+	 * \brief Assignment operator is disabled.
+	 */
+	fair_queue& operator=(const fair_queue&) = delete;
+	
+	/**
+	 * \brief Move assignment operator.
+	 */
+	fair_queue& operator=(fair_queue&& old) = default;
+	
+	/**
+	 * \brief Set the number of items a flow hands out per turn.
+	 */
+	inline void set_weight(const flow_t flow, const std::size_t weight) {
+		if(UNLIKELY(weight == 0)) {
+			throw std::invalid_argument(err_msg::_zrlngth);
+		}
+		
+		_flows[flow].weight = weight;
+	}
+	
+	/**
+	 * \brief Set the number of items per turn of the flows without a weight of their
+	 * own.
+	 */
+	inline void set_default_weight(const std::size_t weight) {
+		if(UNLIKELY(weight == 0)) {
+			throw std::invalid_argument(err_msg::_zrlngth);
+		}
+		
+		_defaultWeight = weight;
+	}
+	
+	/**
+	 * \brief Return the number of items.
+	 */
+	inline std::size_t size() const {
+		return _size;
+	}
+	
+	/**
+	 * \brief Return whether there are no items.
+	 */
+	inline bool empty() const {
+		return _size == 0;
+	}
+	
+	/**
+	 * \brief Add an item to the priority lane or to the end of its flow.
+	 */
+	inline void push(T&& item) {
+		_size++;
+		
+		if(item.priority()) {
+			_priority.push(std::move(item));
+			return;
+		}
+		
+		const flow_t flow = item.flow();
+		flow_state& state = _flows[flow];
+		if(state.items.empty()) {
+			_active.push_back(flow);
+		}
+		state.items.push(std::move(item));
+	}
+	
+	/**
+	 * \brief Return the item that pop() removes next.
+	 */
+	inline T& front() {
+		assert(_size != 0);
+		
+		if(!_priority.empty()) {
+			return _priority.front();
+		}
+		
+		return _flows[_active.front()].items.front();
+	}
+	
+	/**
+	 * \brief Remove the item returned by front().
+	 */
+	inline void pop() {
+		assert(_size != 0);
+		
+		_size--;
+		
+		if(!_priority.empty()) {
+			_priority.pop();
+			return;
+		}
+		
+		const flow_t flow = _active.front();
+		flow_state& state = _flows[flow];
+		if(state.deficit == 0) {
+			state.deficit = (state.weight != 0 ? state.weight : _defaultWeight);
+		}
+		
+		state.items.pop();
+		state.deficit--;
+		
+		// A flow that runs dry gives up the rest of its turn, so it cannot save up
+		if(state.items.empty()) {
+			state.deficit = 0;
+			_active.pop_front();
+		} else if(state.deficit == 0) {
+			_active.pop_front();
+			_active.push_back(flow);
+		}
+	}
+
+ private:
+	/**
+	 * \brief The total number of items.
+	 */
+	std::size_t _size;
+	
+	/**
+	 * \brief The items handed out before any flow.
+	 */
+	std::queue<T> _priority;
+	
+	/**
+	 * \brief Every flow seen so far.
+	 */
+	std::unordered_map<flow_t, flow_state> _flows;
+	
+	/**
+	 * \brief The flows with items in the order of their turns, where the first flow
+	 * has the current turn.
+	 */
+	std::deque<flow_t> _active;
+	
+	/**
+	 * \brief The items per turn of a flow without a weight of its own.
+	 */
+	std::size_t _defaultWeight;
+};
+
+#endif
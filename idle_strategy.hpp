@@ -0,0 +1,153 @@
+#ifndef _IDLE_STRATEGY_HPP
+#define _IDLE_STRATEGY_HPP
+
+#include <common.hpp>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+
+/**
+ * \brief The number of times a spin_yield strategy checks for work while spinning,
+ * before it starts to yield.
+ */
+#define IDLE_STRATEGY_SPINS 4096
+
+/**
+ * \brief The number of times a spin_yield strategy yields the processor, before it
+ * parks.
+ */
+#define IDLE_STRATEGY_YIELDS 64
+
+/**
+ * \brief The number of checks a spinning strategy makes between looking at the clock.
+ */
+#define IDLE_STRATEGY_CLOCK_INTERVAL 256
+
+/**
+ * \brief Tell the processor we are spinning, which saves power and lets a sibling
+ * hyperthread run.
+ */
+#if defined(__x86_64__) || defined(__i386__)
+#define CPU_RELAX() __builtin_ia32_pause()
+#else
+#define CPU_RELAX() ((void)0)
+#endif
+
+/**
+ * \brief How a worker thread waits for work.
+ */
+enum class idle_mode {
+	/**
+	 * \brief Check for work in a loop without ever giving up the processor, for the
+	 * lowest latency at the cost of a whole core.
+	 */
+	spin,
+	
+	/**
+	 * \brief Spin for a while, then yield the processor for a while, then park.
+	 */
+	spin_yield,
+	
+	/**
+	 * \brief Sleep until work is pushed or the wait times out.
+	 */
+	park
+};
+
+/**
+ * \brief How a worker thread waits for work, which is one of idle_mode.
+ */
+class idle_strategy {
+ public:
+	/**
+	 * \brief Constructor of a strategy that parks.
+	 */
+	idle_strategy()
+			: _mode(idle_mode::park) {
+	}
+	
+	/**
+	 * \brief Constructor.
+	 */
+	explicit idle_strategy(const idle_mode mode)
+			: _mode(mode) {
+	}
+	
+	/**
+	 * \brief Constructor takes the name of a mode: "spin", "yield" or "park".
+	 */
+	explicit idle_strategy(const char* const mode) {
+		if(strcmp(mode, "spin") == 0) {
+			_mode = idle_mode::spin;
+		} else if(strcmp(mode, "yield") == 0) {
+			_mode = idle_mode::spin_yield;
+		} else if(strcmp(mode, "park") == 0) {
+			_mode = idle_mode::park;
+		} else {
+			throw std::invalid_argument(err_msg::_tpntfnd);
+		}
+	}
+	
+	/**
+	 * \brief Return the mode.
+	 */
+	inline idle_mode mode() const {
+		return _mode;
+	}
+	
+	/**
+	 * \brief Wait up to a specified amount of time for ready() to return true.
+	 * 
+	 * ready() is called over and over while spinning, so it must be cheap and must not
+	 * take a lock. park(milliseconds) sleeps until it is woken or the time is over and
+	 * returns whether there is work, like a push_wait().
+	 * 
+	 * \returns Whether there is work, or false on a timeout.
+	 */
+	template <typename Ready, typename Park>
+			inline bool wait(const std::size_t milliseconds, Ready ready, Park park) const {
+		if(_mode == idle_mode::park) {
+			return park(milliseconds);
+		}
+		
+		typedef std::chrono::steady_clock clock_t;
+		const clock_t::time_point deadline = clock_t::now() +
+				std::chrono::milliseconds(milliseconds);
+		
+		for(std::size_t i = 1; ; i++) {
+			if(ready()) {
+				return true;
+			}
+			
+			if(_mode == idle_mode::spin_yield && i > IDLE_STRATEGY_SPINS) {
+				if(i > IDLE_STRATEGY_SPINS + IDLE_STRATEGY_YIELDS) {
+					// Nothing is coming soon, so sleep through the rest of the wait
+					const clock_t::time_point now = clock_t::now();
+					if(now >= deadline) {
+						return false;
+					}
+					
+					return park(std::chrono::duration_cast<std::chrono::milliseconds>(
+							deadline - now).count());
+				}
+				
+				std::this_thread::yield();
+			} else {
+				CPU_RELAX();
+			}
+			
+			if(i % IDLE_STRATEGY_CLOCK_INTERVAL == 0 && clock_t::now() >= deadline) {
+				return false;
+			}
+		}
+	}
+
+ private:
+	/**
+	 * \brief The mode.
+	 */
+	idle_mode _mode;
+};
+
+#endif
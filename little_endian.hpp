@@ -0,0 +1,73 @@
+#ifndef _LITTLE_ENDIAN_HPP
+#define _LITTLE_ENDIAN_HPP
+
+#include <common.hpp>
+#include <cstdint>
+#include <type_traits>
+#include <boost/detail/endian.hpp>
+
+/**
+ * \brief Reading and writing of little-endian values in binary wire formats.
+ */
+namespace little_endian {
+	/**
+	 * \brief Write an integer to dst in little-endian.
+	 */
+	template <typename T> inline void put(char* const dst, const T value) {
+		static_assert(std::is_integral<T>::value, "Only integers are supported");
+		
+		#ifdef BOOST_LITTLE_ENDIAN
+		memcpy(dst, &value, sizeof(T));
+		#elif defined(BOOST_BIG_ENDIAN)
+		typedef typename std::make_unsigned<T>::type unsigned_t;
+		for(std::size_t i = 0; i < sizeof(T); i++) {
+			dst[i] = (char)((unsigned_t)value >> 8*i);
+		}
+		#else
+		#	error Endianness cannot be detected
+		#endif
+	}
+	
+	/**
+	 * \brief Write a double to dst in little-endian.
+	 */
+	template <> inline void put<double>(char* const dst, const double value) {
+		std::uint64_t bits;
+		memcpy(&bits, &value, sizeof(bits));
+		put<std::uint64_t>(dst, bits);
+	}
+	
+	/**
+	 * \brief Read a little-endian integer from src.
+	 */
+	template <typename T> inline T get(const char* const src) {
+		static_assert(std::is_integral<T>::value, "Only integers are supported");
+		
+		#ifdef BOOST_LITTLE_ENDIAN
+		T value;
+		memcpy(&value, src, sizeof(T));
+		return value;
+		#elif defined(BOOST_BIG_ENDIAN)
+		typedef typename std::make_unsigned<T>::type unsigned_t;
+		unsigned_t value = 0;
+		for(std::size_t i = 0; i < sizeof(T); i++) {
+			value |= (unsigned_t)(unsigned char)src[i] << 8*i;
+		}
+		return (T)value;
+		#else
+		#	error Endianness cannot be detected
+		#endif
+	}
+	
+	/**
+	 * \brief Read a little-endian double from src.
+	 */
+	template <> inline double get<double>(const char* const src) {
+		const std::uint64_t bits = get<std::uint64_t>(src);
+		double value;
+		memcpy(&value, &bits, sizeof(value));
+		return value;
+	}
+}
+
+#endif
@@ -0,0 +1,60 @@
+#include "binary_request.hpp"
+
+namespace net {
+	bool binary_request::parse(const char* const data, const std::size_t size) {
+		_method = action::_COUNT;
+		_blobCount = 0;
+		_hasDelimiter = false;
+		_budget = 0;
+		_simDeadline = 0;
+		
+		if(UNLIKELY(size < NET_BINARY_HEADER_SIZE ||
+				(unsigned char)data[0] != NET_BINARY_MAGIC ||
+				data[1] != NET_BINARY_VERSION)) {
+			return false;
+		}
+		
+		const std::uint8_t methodId = (std::uint8_t)data[2];
+		if(methodId < enum_value<action>(action::_COUNT)) {
+			_method = static_cast<action>(methodId);
+		}
+		_node = little_endian::get<std::uint32_t>(&data[4]);
+		_sequence = little_endian::get<std::uint32_t>(&data[8]);
+		
+		const char* p = data + NET_BINARY_HEADER_SIZE;
+		const char* const end = data + size;
+		
+		if(data[3] & NET_BINARY_FLAG_DEADLINE) {
+			if(UNLIKELY(end - p < NET_BINARY_DEADLINE_SIZE)) {
+				return false;
+			}
+			
+			_budget = little_endian::get<std::uint32_t>(p);
+			_simDeadline = little_endian::get<std::uint64_t>(p + 4);
+			p += NET_BINARY_DEADLINE_SIZE;
+		}
+		
+		// A string takes at least 5 bytes, so a single byte left over is the delimiter
+		while(end - p > 1) {
+			if(UNLIKELY(_blobCount == NET_BINARY_MAX_BLOBS || end - p < 5)) {
+				return false;
+			}
+			
+			const std::uint32_t length = little_endian::get<std::uint32_t>(p);
+			p += 4;
+			if(UNLIKELY((std::size_t)(end - p) <= length || p[length] != '\0')) {
+				return false;
+			}
+			
+			_blobs[_blobCount++] = p;
+			p += length + 1;
+		}
+		
+		if(p != end) {
+			_hasDelimiter = true;
+			_delimiter = *p;
+		}
+		
+		return true;
+	}
+}
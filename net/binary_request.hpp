@@ -0,0 +1,238 @@
+#ifndef _NET_BINARY_REQUEST_HPP
+#define _NET_BINARY_REQUEST_HPP
+
+#include <common.hpp>
+#include "../action.hpp"
+#include <cstdint>
+#include <stdexcept>
+#include <little_endian.hpp>
+
+/**
+ * \brief The first byte of every binary client request.
+ * 
+ * No JSON document can start with this byte, so the tx server tells the two encodings
+ * apart by looking at the first byte of a request.
+ */
+#define NET_BINARY_MAGIC 0xE1
+
+/**
+ * \brief The version of the binary client encoding we speak.
+ */
+#define NET_BINARY_VERSION 1
+
+/**
+ * \brief The size of the header of a binary request or reply.
+ * 
+ * The header is the magic byte, the version byte, the method id byte, the flags byte,
+ * the node id as a 32 bit unsigned int and the sequence number as a 32 bit unsigned
+ * int.
+ * 
+ * \note Bytes.
+ */
+#define NET_BINARY_HEADER_SIZE 12
+
+/**
+ * \brief The flag of a binary reply that carries an error message.
+ */
+#define NET_BINARY_FLAG_ERROR 0x01
+
+/**
+ * \brief The flag of a binary reply to a request that was turned away because the
+ * server is busy, which is set along with NET_BINARY_FLAG_ERROR.
+ */
+#define NET_BINARY_FLAG_BUSY 0x02
+
+/**
+ * \brief The flag of a binary request whose header is followed by a deadline.
+ */
+#define NET_BINARY_FLAG_DEADLINE 0x04
+
+/**
+ * \brief The size of the deadline of a binary request.
+ * 
+ * \note Bytes.
+ */
+#define NET_BINARY_DEADLINE_SIZE 12
+
+/**
+ * \brief The maximum number of blobs of a binary request.
+ */
+#define NET_BINARY_MAX_BLOBS 4
+
+namespace net {
+	/**
+	 * \brief A binary request from the client.
+	 * 
+	 * Every value is little-endian. The method id is the action enum value, the node id
+	 * is the node id itself and the sequence number is chosen by the client and echoed
+	 * in the reply. If NET_BINARY_FLAG_DEADLINE is set, the header is followed by the
+	 * time the request may wait in milliseconds as a 32 bit unsigned int and the
+	 * simulation time it goes stale at as a 64 bit unsigned int, either 0 for none.
+	 * Then come the string parameters in the order of their JSON counterparts, each a
+	 * 32 bit length followed by the bytes and a null terminator that the length does
+	 * not include, and the delimiter as a single byte for methods that take one.
+	 * 
+	 * A reply is a header that echoes the method id, the node id and the sequence
+	 * number. If NET_BINARY_FLAG_ERROR is set, it is followed by the error message
+	 * encoded like a string parameter. If NET_BINARY_FLAG_BUSY is set as well, that is
+	 * followed by the time to wait before trying again in milliseconds as a 32 bit
+	 * unsigned int.
+	 * 
+	 * Strings are returned as pointers into the message, so decoding neither copies nor
+	 * allocates. Parameter indices match those of the JSON request, where the node id is
+	 * parameter 0.
+	 */
+	struct binary_request {
+	 public:
+		/**
+		 * \brief Constructor of an empty request, see parse().
+		 */
+		binary_request()
+				: _method(action::_COUNT),
+				_node(0),
+				_sequence(0),
+				_budget(0),
+				_simDeadline(0),
+				_blobCount(0),
+				_hasDelimiter(false),
+				_delimiter(0) {
+		}
+		
+		/**
+		 * \brief Copy constructor is disabled.
+		 */
+		binary_request(const binary_request&) = delete;
+		
+		/**
+		 * \brief Assignment operator is disabled.
+		 */
+		binary_request& operator=(const binary_request&) = delete;
+		
+		/**
+		 * \brief Parse a binary request of size bytes and forget the previous request.
+		 * 
+		 * The buffer must outlive every parameter returned.
+		 * 
+		 * \returns whether the request is well formed, in which case method(), node()
+		 * and sequence() are valid.
+		 */
+		bool parse(const char* const data, const std::size_t size);
+		
+		/**
+		 * \brief Return the method, which is action::_COUNT for an unknown method id.
+		 */
+		inline action method() const {
+			return _method;
+		}
+		
+		/**
+		 * \brief Return the node id.
+		 */
+		inline unsigned int node() const {
+			return _node;
+		}
+		
+		/**
+		 * \brief Return the sequence number.
+		 */
+		inline std::uint32_t sequence() const {
+			return _sequence;
+		}
+		
+		/**
+		 * \brief Return the time the request may wait, or 0.
+		 * 
+		 * \note Milliseconds.
+		 */
+		inline std::uint32_t budget() const {
+			return _budget;
+		}
+		
+		/**
+		 * \brief Return the simulation time the request goes stale at, or 0.
+		 */
+		inline std::uint64_t sim_deadline() const {
+			return _simDeadline;
+		}
+		
+		/**
+		 * \brief Return a type T parameter by index.
+		 * 
+		 * \warning You must use a template specialized function.
+		 */
+		template <typename T> inline T parameter(const std::size_t idx) const;
+	
+	 private:
+		/**
+		 * \brief The method.
+		 */
+		action _method;
+		
+		/**
+		 * \brief The node id.
+		 */
+		unsigned int _node;
+		
+		/**
+		 * \brief The sequence number.
+		 */
+		std::uint32_t _sequence;
+		
+		/**
+		 * \brief The time the request may wait.
+		 */
+		std::uint32_t _budget;
+		
+		/**
+		 * \brief The simulation time the request goes stale at.
+		 */
+		std::uint64_t _simDeadline;
+		
+		/**
+		 * \brief The null terminated strings within the message.
+		 */
+		const char* _blobs[NET_BINARY_MAX_BLOBS];
+		
+		/**
+		 * \brief The number of strings.
+		 */
+		std::size_t _blobCount;
+		
+		/**
+		 * \brief Whether the request ends with a delimiter.
+		 */
+		bool _hasDelimiter;
+		
+		/**
+		 * \brief The delimiter.
+		 */
+		char _delimiter;
+	};
+	
+	/**
+	 * \brief Return a cstring parameter by index.
+	 */
+	template <> inline const char*
+			binary_request::parameter<const char*>(const std::size_t idx) const {
+		// Whatever the build, a client must not make us read past the message
+		if(UNLIKELY(idx == 0 || idx > _blobCount)) {
+			throw std::invalid_argument(err_msg::_arybnds);
+		}
+		
+		return _blobs[idx - 1];
+	}
+	
+	/**
+	 * \brief Return a char parameter by index.
+	 */
+	template <> inline char
+			binary_request::parameter<char>(const std::size_t idx) const {
+		if(UNLIKELY(!_hasDelimiter || idx != _blobCount + 1)) {
+			throw std::invalid_argument(err_msg::_arybnds);
+		}
+		
+		return _delimiter;
+	}
+}
+
+#endif
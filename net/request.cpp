@@ -0,0 +1,367 @@
+#include "request.hpp"
+
+namespace net {
+	namespace {
+		/**
+		 * \brief Skip JSON whitespace.
+		 */
+		inline void skip_whitespace(const char*& p, const char* const end) {
+			while(p != end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) {
+				p++;
+			}
+		}
+		
+		/**
+		 * \brief Return the value of a hex digit, or -1 if it is not one.
+		 */
+		inline int hex_value(const char c) {
+			if(c >= '0' && c <= '9') {
+				return c - '0';
+			} else if(c >= 'a' && c <= 'f') {
+				return c - 'a' + 10;
+			} else if(c >= 'A' && c <= 'F') {
+				return c - 'A' + 10;
+			}
+			return -1;
+		}
+		
+		/**
+		 * \brief Read the four hex digits of a \\u escape at p, or return -1.
+		 */
+		inline long read_code_unit(const char* const p, const char* const end) {
+			if(end - p < 4) {
+				return -1;
+			}
+			
+			long result = 0;
+			for(std::size_t i = 0; i < 4; i++) {
+				const int digit = hex_value(p[i]);
+				if(digit < 0) {
+					return -1;
+				}
+				result = (result << 4) | digit;
+			}
+			
+			return result;
+		}
+	}
+	
+	bool request::parse(char* const str, const std::size_t size) {
+		_buffer = str;
+		_tokenCount = 0;
+		_parameterCount = 0;
+		_useDom = false;
+		_valid = false;
+		
+		if(LIKELY(scan(str, size))) {
+			_valid = true;
+			return true;
+		}
+		
+		// Anything unusual is left to rapidjson, which also tells us if it is invalid
+		if(_dom == nullptr) {
+			_dom = new ::rapidjson::Document();
+		}
+		
+		_useDom = true;
+		_dom->Parse<::rapidjson::kParseStopWhenDoneFlag>(str, size);
+		_valid = (!_dom->HasParseError() &&
+				_dom->IsObject() &&
+				_dom->HasMember("method") &&
+				(*_dom)["method"].IsString() &&
+				_dom->HasMember("parameters") &&
+				(*_dom)["parameters"].IsArray());
+		
+		return _valid;
+	}
+	
+	bool request::scan(const char* const str, const std::size_t size) {
+		const char* p = str;
+		const char* const end = str + size;
+		bool hasMethod = false;
+		bool hasParameters = false;
+		
+		skip_whitespace(p, end);
+		if(p == end || *p++ != '{') {
+			return false;
+		}
+		
+		while(true) {
+			skip_whitespace(p, end);
+			
+			token key;
+			if(p == end || *p != '"' || !scan_string(p, end, key) || key.escaped) {
+				return false;
+			}
+			
+			skip_whitespace(p, end);
+			if(p == end || *p++ != ':') {
+				return false;
+			}
+			skip_whitespace(p, end);
+			
+			const char* const name = &str[key.begin];
+			if(key.size == 6 && memcmp(name, "method", 6) == 0 && !hasMethod) {
+				if(p == end || *p != '"' || !scan_string(p, end, _method) || _method.escaped) {
+					return false;
+				}
+				hasMethod = true;
+			} else if(key.size == 10 && memcmp(name, "parameters", 10) == 0 && !hasParameters) {
+				if(p == end || *p++ != '[') {
+					return false;
+				}
+				
+				skip_whitespace(p, end);
+				if(p != end && *p == ']') {
+					p++;
+				} else {
+					while(true) {
+						if(_parameterCount == NET_REQUEST_MAX_PARAMETERS) {
+							return false;
+						}
+						_parameters[_parameterCount++] = (std::uint16_t)_tokenCount;
+						
+						if(!scan_value(p, end, false)) {
+							return false;
+						}
+						
+						skip_whitespace(p, end);
+						if(p == end) {
+							return false;
+						} else if(*p == ']') {
+							p++;
+							break;
+						} else if(*p++ != ',') {
+							return false;
+						}
+						skip_whitespace(p, end);
+					}
+				}
+				hasParameters = true;
+			} else {
+				// Unknown or repeated members are left to the DOM
+				return false;
+			}
+			
+			skip_whitespace(p, end);
+			if(p == end) {
+				return false;
+			} else if(*p == '}') {
+				p++;
+				break;
+			} else if(*p++ != ',') {
+				return false;
+			}
+		}
+		
+		// Clients null terminate their requests
+		skip_whitespace(p, end);
+		while(p != end && *p == '\0') {
+			p++;
+		}
+		
+		return (p == end && hasMethod && hasParameters);
+	}
+	
+	bool request::scan_value(const char*& p, const char* const end, const bool nested) {
+		if(p == end || _tokenCount == NET_REQUEST_MAX_TOKENS) {
+			return false;
+		}
+		
+		token& tkn = _tokens[_tokenCount++];
+		tkn.begin = (std::uint32_t)(p - _buffer);
+		tkn.escaped = false;
+		tkn.decoded = false;
+		
+		switch(*p) {
+		 case '"':
+			tkn.type = kind::string;
+			return scan_string(p, end, tkn);
+		 case 't':
+			tkn.type = kind::true_value;
+			tkn.size = 4;
+			if(end - p < 4 || memcmp(p, "true", 4) != 0) {
+				return false;
+			}
+			p += 4;
+			return true;
+		 case 'f':
+			tkn.type = kind::false_value;
+			tkn.size = 5;
+			if(end - p < 5 || memcmp(p, "false", 5) != 0) {
+				return false;
+			}
+			p += 5;
+			return true;
+		 case 'n':
+			tkn.type = kind::null_value;
+			tkn.size = 4;
+			if(end - p < 4 || memcmp(p, "null", 4) != 0) {
+				return false;
+			}
+			p += 4;
+			return true;
+		 case '[':
+		 {
+			if(nested) {
+				return false;
+			}
+			
+			tkn.type = kind::array;
+			tkn.size = 0;
+			p++;
+			
+			skip_whitespace(p, end);
+			if(p != end && *p == ']') {
+				p++;
+				return true;
+			}
+			
+			while(true) {
+				if(!scan_value(p, end, true)) {
+					return false;
+				}
+				tkn.size++;
+				
+				skip_whitespace(p, end);
+				if(p == end) {
+					return false;
+				} else if(*p == ']') {
+					p++;
+					return true;
+				} else if(*p++ != ',') {
+					return false;
+				}
+				skip_whitespace(p, end);
+			}
+		 }
+		 default:
+		 {
+			if(*p != '-' && (*p < '0' || *p > '9')) {
+				// Objects and anything invalid are left to the DOM
+				return false;
+			}
+			
+			tkn.type = kind::number;
+			const char* const begin = p;
+			while(p != end && ((*p >= '0' && *p <= '9') ||
+					*p == '-' || *p == '+' || *p == '.' || *p == 'e' || *p == 'E')) {
+				p++;
+			}
+			tkn.size = (std::uint32_t)(p - begin);
+			
+			// A number must be followed by something, so decoding it never runs past
+			// the buffer
+			return (p != end);
+		 }
+		}
+	}
+	
+	bool request::scan_string(const char*& p, const char* const end, token& tkn) const {
+		const char* const begin = ++p;
+		tkn.type = kind::string;
+		tkn.escaped = false;
+		tkn.decoded = false;
+		
+		while(p != end && *p != '"') {
+			if(*p == '\\') {
+				tkn.escaped = true;
+				if(++p == end) {
+					return false;
+				}
+			} else if((unsigned char)*p < 0x20) {
+				// Control characters must be escaped
+				return false;
+			}
+			p++;
+		}
+		
+		if(p == end) {
+			return false;
+		}
+		
+		tkn.begin = (std::uint32_t)(begin - _buffer);
+		tkn.size = (std::uint32_t)(p - begin);
+		p++;
+		
+		return true;
+	}
+	
+	void request::decode(token& tkn) const {
+		char* const begin = &_buffer[tkn.begin];
+		const char* const end = begin + tkn.size;
+		
+		if(tkn.escaped) {
+			// Unescaping never lengthens a string, so we write behind where we read
+			const char* in = begin;
+			char* out = begin;
+			
+			while(in != end) {
+				if(*in != '\\') {
+					*out++ = *in++;
+					continue;
+				}
+				
+				in++;
+				switch(*in++) {
+				 case '"': *out++ = '"'; break;
+				 case '\\': *out++ = '\\'; break;
+				 case '/': *out++ = '/'; break;
+				 case 'b': *out++ = '\b'; break;
+				 case 'f': *out++ = '\f'; break;
+				 case 'n': *out++ = '\n'; break;
+				 case 'r': *out++ = '\r'; break;
+				 case 't': *out++ = '\t'; break;
+				 case 'u':
+				 {
+					long code = read_code_unit(in, end);
+					if(code < 0) {
+						// Keep an invalid escape as it is
+						*out++ = '\\';
+						*out++ = 'u';
+						break;
+					}
+					in += 4;
+					
+					// A high surrogate followed by a low surrogate is one code point
+					if(code >= 0xD800 && code <= 0xDBFF && end - in >= 6 &&
+							in[0] == '\\' && in[1] == 'u') {
+						const long low = read_code_unit(in + 2, end);
+						if(low >= 0xDC00 && low <= 0xDFFF) {
+							code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+							in += 6;
+						}
+					}
+					
+					if(code < 0x80) {
+						*out++ = (char)code;
+					} else if(code < 0x800) {
+						*out++ = (char)(0xC0 | (code >> 6));
+						*out++ = (char)(0x80 | (code & 0x3F));
+					} else if(code < 0x10000) {
+						*out++ = (char)(0xE0 | (code >> 12));
+						*out++ = (char)(0x80 | ((code >> 6) & 0x3F));
+						*out++ = (char)(0x80 | (code & 0x3F));
+					} else {
+						*out++ = (char)(0xF0 | (code >> 18));
+						*out++ = (char)(0x80 | ((code >> 12) & 0x3F));
+						*out++ = (char)(0x80 | ((code >> 6) & 0x3F));
+						*out++ = (char)(0x80 | (code & 0x3F));
+					}
+					break;
+				 }
+				 default:
+					// Keep an invalid escape as it is
+					*out++ = '\\';
+					*out++ = in[-1];
+				}
+			}
+			
+			tkn.size = (std::uint32_t)(out - begin);
+		}
+		
+		// This overwrites the closing quote or what is left behind by unescaping
+		begin[tkn.size] = '\0';
+		tkn.decoded = true;
+	}
+}
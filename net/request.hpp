@@ -2,71 +2,187 @@
 #define _NET_REQUEST_HPP
 
 #include <common.hpp>
+#include <cstdint>
+#include <cstdlib>
 #include <rapidjson/document.h>
 
+/**
+ * \brief The maximum number of JSON values of a request the fast parser keeps track of.
+ * 
+ * Every parameter is a value, and so is every element of an array parameter, so a
+ * tx_batch of n transmissions takes 4n + 4 values. Requests with more values are parsed
+ * into a DOM instead.
+ */
+#define NET_REQUEST_MAX_TOKENS 1024
+
+/**
+ * \brief The maximum number of parameters of a request the fast parser keeps track of.
+ * 
+ * Requests with more parameters are parsed into a DOM instead.
+ */
+#define NET_REQUEST_MAX_PARAMETERS 16
+
 namespace net {
 	/**
 	 * \brief A JSON request from the client.
 	 * 
 	 * All requests are UTF-8.
+	 * 
+	 * Requests of the usual {"method":..., "parameters":[...]} shape, whose parameters are
+	 * scalars or arrays of scalars, are parsed by a single forward scan that only records
+	 * where each value is. Values are decoded when they are accessed, and strings are
+	 * unescaped and null terminated in place in the buffer, so nothing is copied or
+	 * allocated. Any other request is parsed into a rapidjson DOM.
+	 * 
+	 * A request is meant to be reused for every message a worker receives, which keeps
+	 * the DOM, and the memory it holds, around for the rare request that needs it.
 	 */
 	struct request {
-	 public:
+	 private:
 		/**
-		 * \brief Decoding constructor takes in a JSON cstring that is mutable.
+		 * \brief Stand-in element index of a parameter itself rather than an element of
+		 * an array parameter.
 		 */
-		request(char* const str) {
-			#ifdef THROW
-			//if(str == 0) {
-			//	throw std::invalid_argument(err_msg::_nllpntr);
-			//}
-			#endif
+		static constexpr std::size_t npos = (std::size_t)-1;
+		
+		/**
+		 * \brief The kinds of values the fast parser knows about.
+		 */
+		enum class kind : std::uint8_t {
+			string,
+			number,
+			true_value,
+			false_value,
+			null_value,
+			array
+		};
+		
+		/**
+		 * \brief The position of a value within the buffer.
+		 */
+		struct token {
+			/**
+			 * \brief The offset of the first character.
+			 * 
+			 * For a string, this is the character after the opening quote.
+			 */
+			std::uint32_t begin;
+			
+			/**
+			 * \brief The number of characters, without the quotes of a string.
+			 * 
+			 * For an array, this is the number of elements, whose tokens directly follow
+			 * that of the array.
+			 */
+			std::uint32_t size;
 			
-			//WE NEED TO FIX THIS!!
-			_dom.Parse(str);
+			/**
+			 * \brief The kind of value.
+			 */
+			kind type;
+			
+			/**
+			 * \brief Whether a string contains escape sequences.
+			 */
+			bool escaped;
+			
+			/**
+			 * \brief Whether a string has been unescaped and null terminated in place.
+			 */
+			bool decoded;
+		};
+	
+	 public:
+		/**
+		 * \brief Constructor of an empty request, see parse().
+		 */
+		request()
+				: _buffer(nullptr),
+				_tokenCount(0),
+				_parameterCount(0),
+				_dom(nullptr),
+				_useDom(false),
+				_valid(false) {
 		}
+		
+		/**
+		 * \brief Decoding constructor takes in a JSON string that is mutable, see parse().
+		 */
+		request(char* const str, const std::size_t size)
+				: request() {
+			parse(str, size);
+		}
+		
 		/**
 		 * \brief Copy constructor is disabled.
-		 * 
-		 * It is disabled implicitly because of the rapidjson member, so we make this deletion obvious.
 		 */
 		request(const request&) = delete;
 		
 		/**
-		 * \brief Move constructor.
+		 * \brief Move constructor is disabled.
 		 */
-		request(request&& old)
-				: _dom(std::move(old._dom)) {
-		}
+		request(request&&) = delete;
 		
 		/**
 		 * \brief Assignment operator is disabled.
-		 * 
-		 * It is disabled implicitly because of the rapidjson member, so we make this deletion obvious.
 		 */
 		request& operator=(const request&) = delete; 
 		
 		/**
-		 * \brief Move assignment operator.
+		 * \brief Move assignment operator is disabled.
 		 */
-		request& operator=(request&& old) {
-			_dom = std::move(old._dom);
-			
-			return *this;
+		request& operator=(request&&) = delete;
+		
+		/**
+		 * \brief Destructor.
+		 */
+		~request() {
+			delete _dom;
 		}
 		
 		/**
-		 * \brief Return the method name.
+		 * \brief Parse a JSON string of size characters, which need not be null
+		 * terminated, and forget the previous request.
+		 * 
+		 * The buffer is left untouched until parameters are accessed, and must outlive
+		 * every parameter returned.
+		 * 
+		 * \returns whether the request has a method and an array of parameters.
 		 */
-		inline const char* method() const {
-			return _dom["method"].GetString();
+		bool parse(char* const str, const std::size_t size);
+		
+		/**
+		 * \brief Return whether the last request parsed has a method and an array of
+		 * parameters.
+		 */
+		inline bool valid() const {
+			return _valid;
+		}
+		
+		/**
+		 * \brief Return the method name, or an empty view if the request is invalid.
+		 * 
+		 * \note The view is not null terminated.
+		 */
+		inline str_view method() const {
+			if(UNLIKELY(_useDom)) {
+				return (_valid
+						? str_view((*_dom)["method"].GetString(), (*_dom)["method"].GetStringLength())
+						: str_view());
+			}
+			
+			return str_view(&_buffer[_method.begin], _method.size);
 		}
 		
 		/**
 		 * \brief Return the number of parameters.
 		 */
 		inline std::size_t parameter_count() const {
-			return _dom["parameters"].Size();
+			if(UNLIKELY(_useDom)) {
+				return (*_dom)["parameters"].Size();
+			}
+			
+			return _parameterCount;
 		}
 		
 		/**
@@ -75,22 +191,269 @@ namespace net {
 		 * \warning You must use a template specialized function.
 		 */
 		template <typename T> inline T parameter(const std::size_t idx) const;
+		
+		/**
+		 * \brief Return the number of elements of an array parameter.
+		 */
+		inline std::size_t parameter_size(const std::size_t idx) const {
+			return array_size(idx);
+		}
+		
+		/**
+		 * \brief Return element i of a type T array parameter by index.
+		 * 
+		 * Unlike the array parameters, this does not allocate.
+		 * 
+		 * \warning You must use a template specialized function.
+		 */
+		template <typename T> inline T element(const std::size_t idx, const std::size_t i) const;
 	
 	 private:
 		/**
-		 * \brief The rapidjson DOM which contains parsed values.
+		 * \brief The buffer of the request.
+		 */
+		char* _buffer;
+		
+		/**
+		 * \brief The token of the method string.
+		 */
+		token _method;
+		
+		/**
+		 * \brief The tokens of the parameters and their array elements.
+		 * 
+		 * Strings are decoded lazily by const accessors, hence mutable.
+		 */
+		mutable token _tokens[NET_REQUEST_MAX_TOKENS];
+		
+		/**
+		 * \brief The number of tokens.
+		 */
+		std::size_t _tokenCount;
+		
+		/**
+		 * \brief The token index of each parameter.
+		 */
+		std::uint16_t _parameters[NET_REQUEST_MAX_PARAMETERS];
+		
+		/**
+		 * \brief The number of parameters.
+		 */
+		std::size_t _parameterCount;
+		
+		/**
+		 * \brief The rapidjson DOM of requests the fast parser does not handle.
+		 * 
+		 * \note We own this memory. It is only allocated once it is needed.
+		 */
+		::rapidjson::Document* _dom;
+		
+		/**
+		 * \brief Whether the last request was parsed into the DOM.
+		 */
+		bool _useDom;
+		
+		/**
+		 * \brief Whether the last request is valid.
+		 */
+		bool _valid;
+		
+		/**
+		 * \brief Scan a request of the usual shape, recording the tokens.
+		 * 
+		 * \returns false if the request has any other shape.
+		 */
+		bool scan(const char* const str, const std::size_t size);
+		
+		/**
+		 * \brief Scan a value at p and add its token, advancing p past it.
+		 * 
+		 * Arrays are only allowed if nested is false, and their elements must be scalars.
+		 */
+		bool scan_value(const char*& p, const char* const end, const bool nested);
+		
+		/**
+		 * \brief Scan a string at p, which points at the opening quote, and fill tkn,
+		 * advancing p past the closing quote.
+		 */
+		bool scan_string(const char*& p, const char* const end, token& tkn) const;
+		
+		/**
+		 * \brief Unescape a string token in place and null terminate it.
+		 */
+		void decode(token& tkn) const;
+		
+		/**
+		 * \brief Return the token of a parameter, or of element i of an array parameter.
+		 */
+		inline token& value_token(const std::size_t idx, const std::size_t i) const {
+			#ifdef THROW
+			if(UNLIKELY(idx >= _parameterCount)) {
+				throw std::invalid_argument(err_msg::_arybnds);
+			}
+			#endif
+			
+			const std::size_t pos = _parameters[idx];
+			if(i == npos) {
+				return _tokens[pos];
+			}
+			
+			#ifdef THROW
+			if(UNLIKELY(_tokens[pos].type != kind::array || i >= _tokens[pos].size)) {
+				throw std::invalid_argument(err_msg::_arybnds);
+			}
+			#endif
+			
+			return _tokens[pos + 1 + i];
+		}
+		
+		/**
+		 * \brief Return the DOM value of a parameter, or of element i of an array
+		 * parameter.
+		 */
+		inline const ::rapidjson::Value& dom_value(const std::size_t idx, const std::size_t i) const {
+			const auto& value = (*_dom)["parameters"][idx];
+			return (i == npos ? value : value[i]);
+		}
+		
+		/**
+		 * \brief Return the number of elements of an array parameter.
+		 */
+		inline std::size_t array_size(const std::size_t idx) const {
+			if(UNLIKELY(_useDom)) {
+				return dom_value(idx, npos).Size();
+			}
+			
+			return value_token(idx, npos).size;
+		}
+		
+		/**
+		 * \brief Return a type T parameter by index, or element i of an array parameter.
 		 * 
-		 * Uses UTF-8 by default.
+		 * \warning You must use a template specialized function.
 		 */
-		::rapidjson::Document _dom;
+		template <typename T> inline T value(const std::size_t idx, const std::size_t i = npos) const;
 	};
 	
+	/**
+	 * \brief Return a string value.
+	 */
+	template <> inline str_view
+			request::value<str_view>(const std::size_t idx, const std::size_t i) const {
+		if(UNLIKELY(_useDom)) {
+			const auto& v = dom_value(idx, i);
+			return str_view(v.GetString(), v.GetStringLength());
+		}
+		
+		auto& tkn = value_token(idx, i);
+		if(!tkn.decoded) {
+			decode(tkn);
+		}
+		
+		return str_view(&_buffer[tkn.begin], tkn.size);
+	}
+	
+	/**
+	 * \brief Return a cstring value.
+	 */
+	template <> inline const char*
+			request::value<const char*>(const std::size_t idx, const std::size_t i) const {
+		if(UNLIKELY(_useDom)) {
+			return dom_value(idx, i).GetString();
+		}
+		
+		// Decoding null terminates the string
+		return value<str_view>(idx, i).data;
+	}
+	
+	/**
+	 * \brief Return a bool value.
+	 */
+	template <> inline bool
+			request::value<bool>(const std::size_t idx, const std::size_t i) const {
+		if(UNLIKELY(_useDom)) {
+			return dom_value(idx, i).GetBool();
+		}
+		
+		return (value_token(idx, i).type == kind::true_value);
+	}
+	
+	/**
+	 * \brief Return an unsigned integer value.
+	 */
+	template <> inline std::uint64_t
+			request::value<std::uint64_t>(const std::size_t idx, const std::size_t i) const {
+		if(UNLIKELY(_useDom)) {
+			return dom_value(idx, i).GetUint64();
+		}
+		
+		const auto& tkn = value_token(idx, i);
+		const char* p = &_buffer[tkn.begin];
+		const char* const end = p + tkn.size;
+		
+		std::uint64_t result = 0;
+		while(p != end && *p >= '0' && *p <= '9') {
+			result = result*10 + (*p++ - '0');
+		}
+		
+		return result;
+	}
+	
+	/**
+	 * \brief Return a signed integer value.
+	 */
+	template <> inline std::int64_t
+			request::value<std::int64_t>(const std::size_t idx, const std::size_t i) const {
+		if(UNLIKELY(_useDom)) {
+			return dom_value(idx, i).GetInt64();
+		}
+		
+		const auto& tkn = value_token(idx, i);
+		const char* p = &_buffer[tkn.begin];
+		const char* const end = p + tkn.size;
+		
+		const bool negative = (p != end && *p == '-');
+		if(negative) {
+			p++;
+		}
+		
+		std::uint64_t result = 0;
+		while(p != end && *p >= '0' && *p <= '9') {
+			result = result*10 + (*p++ - '0');
+		}
+		
+		return (negative ? -(std::int64_t)result : (std::int64_t)result);
+	}
+	
+	/**
+	 * \brief Return a double value.
+	 */
+	template <> inline double
+			request::value<double>(const std::size_t idx, const std::size_t i) const {
+		if(UNLIKELY(_useDom)) {
+			return dom_value(idx, i).GetDouble();
+		}
+		
+		// The scan made sure a character that is not part of the number follows it
+		return strtod(&_buffer[value_token(idx, i).begin], nullptr);
+	}
+	
 	/**
 	 * \brief Return a cstring parameter by index.
 	 */
 	template <> inline const char*
 			request::parameter<const char*>(const std::size_t idx) const {
-		return _dom["parameters"][idx].GetString();
+		return value<const char*>(idx);
+	}
+	
+	/**
+	 * \brief Return a string parameter by index.
+	 * 
+	 * \note The view is into the buffer of the request.
+	 */
+	template <> inline str_view
+			request::parameter<str_view>(const std::size_t idx) const {
+		return value<str_view>(idx);
 	}
 	
 	/**
@@ -100,10 +463,10 @@ namespace net {
 	 */
 	template <> inline const char* const*
 			request::parameter<const char* const*>(const std::size_t idx) const {
-		auto size = _dom["parameters"][idx].Size();
+		auto size = array_size(idx);
 		auto array = new const char*[size];
 		for(std::size_t i = 0; i < size; i++) {
-			array[i] = _dom["parameters"][idx][i].GetString();
+			array[i] = value<const char*>(idx, i);
 		}
 		
 		return array;
@@ -114,7 +477,7 @@ namespace net {
 	 */
 	template <> inline bool
 			request::parameter<bool>(const std::size_t idx) const {
-		return _dom["parameters"][idx].GetBool();
+		return value<bool>(idx);
 	}
 	
 	/**
@@ -124,10 +487,10 @@ namespace net {
 	 */
 	template <> inline bool*
 			request::parameter<bool*>(const std::size_t idx) const {
-		auto size = _dom["parameters"][idx].Size();
+		auto size = array_size(idx);
 		auto array = new bool[size];
 		for(std::size_t i = 0; i < size; i++) {
-			array[i] = _dom["parameters"][idx][i].GetBool();
+			array[i] = value<bool>(idx, i);
 		}
 		
 		return array;
@@ -138,7 +501,7 @@ namespace net {
 	 */
 	template <> inline char
 			request::parameter<char>(const std::size_t idx) const {
-		return _dom["parameters"][idx].GetString()[0];
+		return value<const char*>(idx)[0];
 	}
 	
 	/**
@@ -148,7 +511,7 @@ namespace net {
 	 */
 	template <> inline unsigned short
 			request::parameter<unsigned short>(const std::size_t idx) const {
-		return static_cast<unsigned short>(_dom["parameters"][idx].GetUint());
+		return static_cast<unsigned short>(value<std::uint64_t>(idx));
 	}
 	
 	/**
@@ -160,10 +523,10 @@ namespace net {
 	 */
 	template <> inline unsigned short*
 			request::parameter<unsigned short*>(const std::size_t idx) const {
-		auto size = _dom["parameters"][idx].Size();
+		auto size = array_size(idx);
 		auto array = new unsigned short[size];
 		for(std::size_t i = 0; i < size; i++) {
-			array[i] = static_cast<unsigned short>(_dom["parameters"][idx][i].GetUint());
+			array[i] = static_cast<unsigned short>(value<std::uint64_t>(idx, i));
 		}
 		
 		return array;
@@ -176,7 +539,7 @@ namespace net {
 	 */
 	template <> inline short
 			request::parameter<short>(const std::size_t idx) const {
-		return static_cast<short>(_dom["parameters"][idx].GetInt());
+		return static_cast<short>(value<std::int64_t>(idx));
 	}
 	
 	/**
@@ -188,10 +551,10 @@ namespace net {
 	 */
 	template <> inline short*
 			request::parameter<short*>(const std::size_t idx) const {
-		auto size = _dom["parameters"][idx].Size();
+		auto size = array_size(idx);
 		auto array = new short[size];
 		for(std::size_t i = 0; i < size; i++) {
-			array[i] = static_cast<short>(_dom["parameters"][idx][i].GetInt());
+			array[i] = static_cast<short>(value<std::int64_t>(idx, i));
 		}
 		
 		return array;
@@ -202,7 +565,7 @@ namespace net {
 	 */
 	template <> inline unsigned int
 			request::parameter<unsigned int>(const std::size_t idx) const {
-		return _dom["parameters"][idx].GetUint();
+		return value<std::uint64_t>(idx);
 	}
 	
 	/**
@@ -212,10 +575,10 @@ namespace net {
 	 */
 	template <> inline unsigned int*
 			request::parameter<unsigned int*>(const std::size_t idx) const {
-		auto size = _dom["parameters"][idx].Size();
+		auto size = array_size(idx);
 		auto array = new unsigned int[size];
 		for(std::size_t i = 0; i < size; i++) {
-			array[i] = _dom["parameters"][idx][i].GetUint();
+			array[i] = value<std::uint64_t>(idx, i);
 		}
 		
 		return array;
@@ -226,7 +589,7 @@ namespace net {
 	 */
 	template <> inline int
 			request::parameter<int>(const std::size_t idx) const {
-		return _dom["parameters"][idx].GetInt();
+		return value<std::int64_t>(idx);
 	}
 	
 	/**
@@ -236,10 +599,10 @@ namespace net {
 	 */
 	template <> inline int*
 			request::parameter<int*>(const std::size_t idx) const {
-		auto size = _dom["parameters"][idx].Size();
+		auto size = array_size(idx);
 		auto array = new int[size];
 		for(std::size_t i = 0; i < size; i++) {
-			array[i] = _dom["parameters"][idx][i].GetInt();
+			array[i] = value<std::int64_t>(idx, i);
 		}
 		
 		return array;
@@ -250,7 +613,7 @@ namespace net {
 	 */
 	template <> inline unsigned long int
 			request::parameter<unsigned long int>(const std::size_t idx) const {
-		return _dom["parameters"][idx].GetUint64();
+		return value<std::uint64_t>(idx);
 	}
 	
 	/**
@@ -260,10 +623,10 @@ namespace net {
 	 */
 	template <> inline unsigned long int*
 			request::parameter<unsigned long int*>(const std::size_t idx) const {
-		auto size = _dom["parameters"][idx].Size();
+		auto size = array_size(idx);
 		auto array = new unsigned long int[size];
 		for(std::size_t i = 0; i < size; i++) {
-			array[i] = _dom["parameters"][idx][i].GetUint64();
+			array[i] = value<std::uint64_t>(idx, i);
 		}
 		
 		return array;
@@ -274,7 +637,7 @@ namespace net {
 	 */
 	template <> inline long int
 			request::parameter<long int>(const std::size_t idx) const {
-		return _dom["parameters"][idx].GetInt64();
+		return value<std::int64_t>(idx);
 	}
 	
 	/**
@@ -284,10 +647,10 @@ namespace net {
 	 */
 	template <> inline long int*
 			request::parameter<long int*>(const std::size_t idx) const {
-		auto size = _dom["parameters"][idx].Size();
+		auto size = array_size(idx);
 		auto array = new long int[size];
 		for(std::size_t i = 0; i < size; i++) {
-			array[i] = _dom["parameters"][idx][i].GetInt64();
+			array[i] = value<std::int64_t>(idx, i);
 		}
 		
 		return array;
@@ -298,7 +661,7 @@ namespace net {
 	 */
 	template <> inline float
 			request::parameter<float>(const std::size_t idx) const {
-		return _dom["parameters"][idx].GetDouble();
+		return value<double>(idx);
 	}
 	
 	/**
@@ -308,10 +671,10 @@ namespace net {
 	 */
 	template <> inline float*
 			request::parameter<float*>(const std::size_t idx) const {
-		auto size = _dom["parameters"][idx].Size();
+		auto size = array_size(idx);
 		auto array = new float[size];
 		for(std::size_t i = 0; i < size; i++) {
-			array[i] = _dom["parameters"][idx][i].GetDouble();
+			array[i] = value<double>(idx, i);
 		}
 		
 		return array;
@@ -322,7 +685,7 @@ namespace net {
 	 */
 	template <> inline double
 			request::parameter<double>(const std::size_t idx) const {
-		return _dom["parameters"][idx].GetDouble();
+		return value<double>(idx);
 	}
 	
 	/**
@@ -332,14 +695,38 @@ namespace net {
 	 */
 	template <> inline double*
 			request::parameter<double*>(const std::size_t idx) const {
-		auto size = _dom["parameters"][idx].Size();
+		auto size = array_size(idx);
 		auto array = new double[size];
 		for(std::size_t i = 0; i < size; i++) {
-			array[i] = _dom["parameters"][idx][i].GetDouble();
+			array[i] = value<double>(idx, i);
 		}
 		
 		return array;
 	}
+	
+	/**
+	 * \brief Return element i of a cstring array parameter by index.
+	 */
+	template <> inline const char*
+			request::element<const char*>(const std::size_t idx, const std::size_t i) const {
+		return value<const char*>(idx, i);
+	}
+	
+	/**
+	 * \brief Return element i of a char array parameter by index.
+	 */
+	template <> inline char
+			request::element<char>(const std::size_t idx, const std::size_t i) const {
+		return value<const char*>(idx, i)[0];
+	}
+	
+	/**
+	 * \brief Return element i of an unsigned int array parameter by index.
+	 */
+	template <> inline unsigned int
+			request::element<unsigned int>(const std::size_t idx, const std::size_t i) const {
+		return value<std::uint64_t>(idx, i);
+	}
 }
 
 #endif
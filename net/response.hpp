@@ -2,6 +2,7 @@
 #define _NET_RESPONSE_HPP
 
 #include <common.hpp>
+#include <cstdint>
 #include <rapidjson/document.h>
 #include <rapidjson/memorybuffer.h>
 #include <rapidjson/writer.h>
@@ -112,6 +113,40 @@ namespace net {
 			_write(dom);
 		}
 		
+		/**
+		 * \brief Construct error response that asks the client to try again after a
+		 * number of milliseconds.
+		 */
+		response(const char* const error, const std::uint32_t retryAfter) {
+			auto dom(_initialize(true));
+			auto& allocator(dom.GetAllocator());
+			
+			dom.AddMember("result",
+					::rapidjson::Value().SetString(::rapidjson::StringRef(error)),
+					allocator);
+			dom.AddMember("retry_after",
+					::rapidjson::Value(retryAfter),
+					allocator);
+			
+			_write(dom);
+		}
+		
+		/**
+		 * \brief Construct response with an array of bool result.
+		 */
+		response(const bool* const result,
+				const std::size_t size,
+				const bool error = false) {
+			auto dom(_initialize(error));
+			auto& allocator(dom.GetAllocator());
+			
+			dom.AddMember("result",
+					rapid_json_array<bool>(result, size, allocator),
+					allocator);
+			
+			_write(dom);
+		}
+		
 		/**
 		 * \brief Construct response with an array of long int result.
 		 */
@@ -0,0 +1,71 @@
+#ifndef _NET_RX_FRAME_HPP
+#define _NET_RX_FRAME_HPP
+
+#include <common.hpp>
+#include "../buffer.hpp"
+#include <cstdint>
+#include <little_endian.hpp>
+
+/**
+ * \brief The first byte of every binary rx frame.
+ */
+#define NET_RX_MAGIC 0xE2
+
+/**
+ * \brief The version of the binary rx encoding we publish.
+ */
+#define NET_RX_VERSION 1
+
+/**
+ * \brief The size of the header of a binary rx frame.
+ * 
+ * The header is the magic byte, the version byte, the flags byte, a reserved byte, the
+ * number of bytes that follow the header as a 32 bit unsigned int, the sequence number
+ * within the topic as a 64 bit unsigned int and the tx timestamp as a 64 bit unsigned int.
+ * 
+ * \note Bytes.
+ */
+#define NET_RX_HEADER_SIZE 24
+
+/**
+ * \brief The flag of a binary rx frame that carries an error message instead of a
+ * result.
+ */
+#define NET_RX_FLAG_ERROR 0x01
+
+namespace net {
+	/**
+	 * \brief Return the size of the binary rx frame of a message.
+	 */
+	inline std::size_t rx_frame_size(const push_message& msg) {
+		return NET_RX_HEADER_SIZE +
+				(msg.error() == nullptr ? sizeof(std::uint64_t) : strlen(msg.error()));
+	}
+	
+	/**
+	 * \brief Write the binary rx frame of a message, which takes rx_frame_size() bytes.
+	 * 
+	 * Every value is little-endian. The result follows the header as a 64 bit unsigned
+	 * int with the first measurement in the most significant bit, an error message
+	 * follows as is, without a null terminator.
+	 */
+	inline void write_rx_frame(char* const frame, const push_message& msg) {
+		const std::size_t bodySize = rx_frame_size(msg) - NET_RX_HEADER_SIZE;
+		
+		frame[0] = (char)NET_RX_MAGIC;
+		frame[1] = NET_RX_VERSION;
+		frame[2] = (msg.error() == nullptr ? 0 : NET_RX_FLAG_ERROR);
+		frame[3] = 0;
+		little_endian::put<std::uint32_t>(&frame[4], (std::uint32_t)bodySize);
+		little_endian::put<std::uint64_t>(&frame[8], msg.sequence());
+		little_endian::put<std::uint64_t>(&frame[16], msg.timestamp());
+		
+		if(msg.error() == nullptr) {
+			little_endian::put<std::uint64_t>(&frame[NET_RX_HEADER_SIZE], msg.result());
+		} else {
+			memcpy(&frame[NET_RX_HEADER_SIZE], msg.error(), bodySize);
+		}
+	}
+}
+
+#endif
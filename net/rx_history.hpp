@@ -0,0 +1,195 @@
+#ifndef _NET_RX_HISTORY_HPP
+#define _NET_RX_HISTORY_HPP
+
+#include <common.hpp>
+#include "../buffer.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * \brief The default number of recent results kept per topic for retransmission.
+ */
+#define NET_RX_HISTORY_DEPTH 1024
+
+namespace net {
+	/**
+	 * \brief The per topic sequence numbers of the rx results of an rx worker, along with
+	 * a ring of the most recent results of each topic.
+	 * 
+	 * The first result of a topic has sequence number 0. A subscriber that sees a gap in
+	 * the sequence numbers of a topic has missed results, which it may fetch again as
+	 * long as they are still within the ring.
+	 */
+	class rx_history {
+	 private:
+		typedef std::lock_guard<std::mutex> lock_t;
+		
+		/**
+		 * \brief A result within the ring.
+		 */
+		struct record {
+			/**
+			 * \brief Constructor of an empty slot.
+			 */
+			record()
+					: sequence(-1),
+					result(0),
+					timestamp(0),
+					isError(false) {
+			}
+			
+			std::uint64_t sequence;
+			std::uint_fast64_t result;
+			std::uint_fast64_t timestamp;
+			bool isError;
+			
+			/**
+			 * \brief The error message, which is empty for a result.
+			 */
+			std::string error;
+		};
+		
+		/**
+		 * \brief What we know about a topic.
+		 */
+		struct topic_history {
+			/**
+			 * \brief The sequence number of the next result.
+			 */
+			std::uint64_t next;
+			
+			/**
+			 * \brief The ring of the most recent results, by sequence number modulo its
+			 * size.
+			 */
+			std::vector<record> ring;
+		};
+	
+	 public:
+		/**
+		 * \brief Constructor.
+		 */
+		rx_history()
+				: _depth(0) {
+		}
+		
+		/**
+		 * \brief Copy constructor is disabled.
+		 */
+		rx_history(const rx_history&) = delete;
+		
+		/**
+		 * \brief Assignment operator is disabled.
+		 */
+		rx_history& operator=(const rx_history&) = delete;
+		
+		/**
+		 * \brief Set the number of recent results kept per topic, which is 0 by default
+		 * so only sequence numbers are kept.
+		 * 
+		 * \warning Must be called before the first result is recorded.
+		 */
+		inline void set_depth(const std::size_t depth) {
+			_depth = depth;
+		}
+		
+		/**
+		 * \brief Give a message the next sequence number of its topic and remember it.
+		 * 
+		 * A topic only allocates the first time it is seen.
+		 * 
+		 * \note Threadsafe
+		 */
+		inline void record_message(push_message& msg) {
+			lock_t lock(_mutex);
+			
+			topic_history& history = _topics[msg.topic()];
+			msg.set_sequence(history.next++);
+			
+			if(_depth == 0) {
+				return;
+			}
+			if(UNLIKELY(history.ring.empty())) {
+				history.ring.resize(_depth);
+			}
+			
+			record& rec = history.ring[msg.sequence() % _depth];
+			rec.sequence = msg.sequence();
+			rec.result = msg.result();
+			rec.timestamp = msg.timestamp();
+			rec.isError = (msg.error() != nullptr);
+			if(rec.isError) {
+				rec.error = msg.error();
+			} else {
+				rec.error.clear();
+			}
+		}
+		
+		/**
+		 * \brief Rebuild the results of a topic from sequence number first to last,
+		 * both included, that are still within the ring, and append them to messages.
+		 * 
+		 * Results that have been overwritten or never existed are left out, so their
+		 * sequence numbers tell what is missing.
+		 * 
+		 * \note Threadsafe
+		 */
+		inline void replay(const push_message::topic_t topic,
+				std::uint64_t first,
+				std::uint64_t last,
+				std::vector<push_message>& messages) {
+			lock_t lock(_mutex);
+			
+			auto i = _topics.find(topic);
+			if(i == _topics.end() || _depth == 0) {
+				return;
+			}
+			
+			// Only the last whole ring of results can still be there
+			const std::uint64_t next = i->second.next;
+			first = std::max<std::uint64_t>(first, (next > _depth ? next - _depth : 0));
+			last = std::min<std::uint64_t>(last, next - 1);
+			if(next == 0 || first > last) {
+				return;
+			}
+			
+			const std::vector<record>& ring = i->second.ring;
+			for(std::uint64_t n = 0; n <= last - first; n++) {
+				const std::uint64_t sequence = first + n;
+				const record& rec = ring[sequence % _depth];
+				if(rec.sequence != sequence) {
+					continue;
+				}
+				
+				if(rec.isError) {
+					messages.push_back(push_message(topic, rec.error.c_str(), rec.timestamp));
+				} else {
+					messages.push_back(push_message(topic, rec.result, rec.timestamp));
+				}
+				messages.back().set_sequence(sequence);
+			}
+		}
+	
+	 private:
+		/**
+		 * \brief Mutex to protect the topics.
+		 */
+		std::mutex _mutex;
+		
+		/**
+		 * \brief What we know about each topic.
+		 */
+		std::unordered_map<push_message::topic_t, topic_history> _topics;
+		
+		/**
+		 * \brief The size of the ring of each topic.
+		 */
+		std::size_t _depth;
+	};
+}
+
+#endif
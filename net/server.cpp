@@ -3,6 +3,151 @@
 namespace net {
 	const int rpc_server::tx_receive_timeout = RPC_SERVER_TX_RECEIVE_TIMEOUT;
 	const int rpc_server::tx_send_timeout = RPC_SERVER_TX_SEND_TIMEOUT;
+	const int rpc_server::ingest_receive_timeout = RPC_SERVER_INGEST_RECEIVE_TIMEOUT;
+	const int rpc_server::rx_replay_receive_timeout = RPC_SERVER_RX_REPLAY_RECEIVE_TIMEOUT;
+	
+	const rpc_server::tx_handler_t<request> rpc_server::txHandlers[ARRAY_LENGTH(_actions)] = {
+			nullptr,
+			&rpc_server::tx_transmit<request>,
+			&rpc_server::tx_configure_qswitch<request>,
+			&rpc_server::tx_configure_node<request>,
+			// Replies per item, see tx_json()
+			nullptr,
+			// Replay endpoint only, see rx_replay_work()
+			nullptr,
+			// Internal
+			nullptr,
+			nullptr,
+			nullptr,
+			nullptr,
+	};
+	
+	const rpc_server::tx_handler_t<binary_request>
+			rpc_server::txBinaryHandlers[ARRAY_LENGTH(_actions)] = {
+			nullptr,
+			&rpc_server::tx_transmit<binary_request>,
+			&rpc_server::tx_configure_qswitch<binary_request>,
+			&rpc_server::tx_configure_node<binary_request>,
+			// JSON only
+			nullptr,
+			nullptr,
+			// Internal
+			nullptr,
+			nullptr,
+			nullptr,
+			nullptr,
+	};
+	
+	namespace {
+		/**
+		 * \brief The messages being published by rx_work().
+		 * 
+		 * zmq may free a message after its socket has closed, until the context is
+		 * terminated, so the pool lives as long as the program does.
+		 */
+		::pool<push_message> rxPool;
+		
+		/**
+		 * \brief Build the reply to a binary request with a given header, which carries
+		 * an error message unless error is null, followed by the time to wait before
+		 * trying again if busy.
+		 */
+		::zmq::message_t binary_reply(const void* const header,
+				const std::size_t headerSize,
+				const char* const error,
+				const overload_error* const busy = nullptr) {
+			const std::size_t errorSize = (error == nullptr ? 0 : strlen(error));
+			::zmq::message_t reply(NET_BINARY_HEADER_SIZE +
+					(error == nullptr ? 0 : sizeof(std::uint32_t) + errorSize + 1) +
+					(busy == nullptr ? 0 : sizeof(std::uint32_t)));
+			char* const dst = static_cast<char*>(reply.data());
+			
+			// Echo the method id, node id and sequence number, so clients can match
+			// replies to requests
+			memset(dst, 0, NET_BINARY_HEADER_SIZE);
+			memcpy(dst, header, std::min<std::size_t>(headerSize, NET_BINARY_HEADER_SIZE));
+			dst[0] = (char)NET_BINARY_MAGIC;
+			dst[1] = NET_BINARY_VERSION;
+			dst[3] = (error == nullptr ? 0 : NET_BINARY_FLAG_ERROR) |
+					(busy == nullptr ? 0 : NET_BINARY_FLAG_BUSY);
+			
+			if(error != nullptr) {
+				char* const payload = dst + NET_BINARY_HEADER_SIZE;
+				little_endian::put<std::uint32_t>(payload, (std::uint32_t)errorSize);
+				memcpy(payload + sizeof(std::uint32_t), error, errorSize + 1);
+				
+				if(busy != nullptr) {
+					little_endian::put<std::uint32_t>(payload + sizeof(std::uint32_t) + errorSize + 1,
+							busy->retry_after());
+				}
+			}
+			
+			return reply;
+		}
+		
+		/**
+		 * \brief The JSON of response(true), which acknowledges most requests.
+		 */
+		const char okJson[] = "{\"result\":true}";
+		
+		/**
+		 * \brief Build a reply that refers to an immutable JSON string, which is neither
+		 * copied nor freed.
+		 */
+		template <std::size_t N> ::zmq::message_t static_reply(const char (&json)[N]) {
+			// Without the null terminator, like response
+			return ::zmq::message_t((void*)json, N - 1, nullptr, nullptr);
+		}
+		
+		/**
+		 * \brief Build the reply to a JSON request, which takes ownership of the
+		 * response.
+		 */
+		::zmq::message_t json_reply(response* const reply) {
+			return ::zmq::message_t((void*)reply->get_json(),
+					reply->get_json_size(),
+					[] (void* data, void* hint) {
+						UNUSED(data);
+						delete static_cast<response*>(hint);
+					},
+					reply);
+		}
+		
+		/**
+		 * \brief Receive a request and its routing envelope without blocking.
+		 * 
+		 * The routing envelope is every frame up to and including the empty delimiter,
+		 * and the request is the last frame.
+		 */
+		bool receive_request(::zmq::socket_t& socket,
+				std::vector<::zmq::message_t>& envelope,
+				::zmq::message_t& msg) {
+			envelope.clear();
+			if(!socket.recv(&msg, ZMQ_DONTWAIT)) {
+				return false;
+			}
+			
+			// The frames of a message arrive together
+			while(msg.more()) {
+				envelope.push_back(std::move(msg));
+				socket.recv(&msg);
+			}
+			
+			return true;
+		}
+		
+		/**
+		 * \brief Send a reply along the routing envelope of its request.
+		 */
+		void send_reply(::zmq::socket_t& socket,
+				std::vector<::zmq::message_t>& envelope,
+				::zmq::message_t& reply) {
+			for(auto& frame : envelope) {
+				socket.send(frame, ZMQ_SNDMORE);
+			}
+			socket.send(reply);
+		}
+	}
 	
 	rpc_server::rpc_server(::zmq::context_t& context,
 			::diagnostics::logger* logger,
@@ -17,14 +162,82 @@ namespace net {
 			txClients(context, ZMQ_ROUTER),
 			txWorkers(context, ZMQ_DEALER),
 			txControl(context, ZMQ_PUB),
+			txDirect(false),
+			txDeferred(false),
+			ingestEndpoint(nullptr),
+			ingestWorkerThreadCount(0),
+			ingestClients(context, ZMQ_PULL),
+			ingestWorkers(context, ZMQ_PUSH),
 			txEndpoint(txEndpoint),
-			rxEndpoint(rxEndpoint) {
+			rxEndpoint(rxEndpoint),
+			rxBinaryEndpoint(nullptr),
+			rxBatchSize(1),
+			rxBatchLatency(0),
+			rxWorkerThreadCount(0),
+			rxWorkersDone(false),
+			rxReplayEndpoint(nullptr),
+			rxReplayDepth(NET_RX_HISTORY_DEPTH),
+			rxShards(context, ZMQ_PULL),
+			rxBinaryShards(context, ZMQ_PULL) {
 	}
 	
 	rpc_server::~rpc_server() {
 		stop();
 	}
 	
+	void rpc_server::set_ingest(const char* const endpoint, const std::size_t workerCount) {
+		if(UNLIKELY(workerCount > NET_SERVER_MAX_INGEST_THREADS)) {
+			throw std::runtime_error(err_msg::_arybnds);
+		}
+		
+		std::lock_guard<std::mutex> lock(stateChangeMutex);
+		
+		ingestEndpoint = endpoint;
+		ingestWorkerThreadCount = workerCount;
+	}
+	
+	void rpc_server::set_rx_binary(const char* const endpoint) {
+		std::lock_guard<std::mutex> lock(stateChangeMutex);
+		
+		rxBinaryEndpoint = endpoint;
+	}
+	
+	void rpc_server::set_rx_batch(const std::size_t size, const std::size_t latency) {
+		if(UNLIKELY(size == 0 || size > NET_SERVER_MAX_RX_BATCH)) {
+			throw std::runtime_error(err_msg::_arybnds);
+		}
+		
+		std::lock_guard<std::mutex> lock(stateChangeMutex);
+		
+		rxBatchSize = size;
+		rxBatchLatency = latency;
+	}
+	
+	void rpc_server::set_rx_idle(const idle_strategy& idle) {
+		std::lock_guard<std::mutex> lock(stateChangeMutex);
+		
+		rxIdle = idle;
+	}
+	
+	void rpc_server::set_rx_replay(const char* const endpoint, const std::size_t depth) {
+		std::lock_guard<std::mutex> lock(stateChangeMutex);
+		
+		rxReplayEndpoint = endpoint;
+		rxReplayDepth = depth;
+	}
+	
+	void rpc_server::set_direct(const bool direct) {
+		std::lock_guard<std::mutex> lock(stateChangeMutex);
+		
+		txDirect = direct;
+	}
+	
+	void rpc_server::set_deferred(const bool deferred) {
+		std::lock_guard<std::mutex> lock(stateChangeMutex);
+		
+		txDeferred = deferred;
+	}
+	
 	void rpc_server::listen(const std::size_t rxWorkerCount, 
 			const std::size_t txWorkerCount) {
 		if(UNLIKELY(rxWorkerCount > NET_SERVER_MAX_RX_THREADS ||
@@ -32,6 +245,12 @@ namespace net {
 			throw std::runtime_error(err_msg::_arybnds);
 		}
 		
+		// Each rx worker drains one outgoing buffer, which the processor has to have
+		// been given before it started
+		if(UNLIKELY(std::max<std::size_t>(rxWorkerCount, 1) != processor.outgoing_shard_count())) {
+			throw std::invalid_argument(err_msg::_arybnds);
+		}
+		
 		std::lock_guard<std::mutex> lock(stateChangeMutex);
 		
 		if(!isRunning) {
@@ -40,29 +259,81 @@ namespace net {
 			 */
 			// Front end where we listen for client requests
 			txClients.bind(txEndpoint);
-			// Internal address worker threads will retrieve work from
-			txWorkers.bind(SERVER_ZMQ_WORKER_LOCATION);
-			// Control socket used to send commands to the steerable proxy,
-			// the device that connects the front end and internal worker address
+			// Control socket used to send commands to the steerable proxies,
+			// the devices that connect the front ends and internal worker addresses
 			txControl.connect(SERVER_ZMQ_CONTROL_LOCATION);
 			
-			// Launch worker thread pool
-			for(std::size_t i = 0; i < txWorkerCount; i++) {
-				txWorkerThreads[i] = std::thread(&rpc_server::tx_work, this, i);
+			if(txDirect) {
+				// A single worker owns the front end, so there is no proxy
+				txClients.setsockopt(ZMQ_SNDTIMEO, &tx_send_timeout, sizeof(tx_send_timeout));
+				txWorkerThreads[0] = std::thread(&rpc_server::tx_serve, this, std::ref(txClients));
+				txWorkerThreadCount = 1;
+			} else {
+				// Internal address worker threads will retrieve work from
+				txWorkers.bind(SERVER_ZMQ_WORKER_LOCATION);
+				
+				// Launch worker thread pool
+				for(std::size_t i = 0; i < txWorkerCount; i++) {
+					txWorkerThreads[i] = std::thread(&rpc_server::tx_work, this, i);
+				}
+				
+				txWorkerThreadCount = txWorkerCount;
+				
+				// Connect work threads to client threads via a so called proxy.
+				// This has a queue that worker threads then consume in a an
+				// (FCFS) manner.
+				txProxyThread = std::thread(&rpc_server::proxy_work,
+						this,
+						std::ref(txClients),
+						std::ref(txWorkers));
 			}
 			
-			txWorkerThreadCount = txWorkerCount;
-			
-			// Connect work threads to client threads via a so called proxy.
-			// This has a queue that worker threads then consume in a an
-			// (FCFS) manner.
-			txProxyThread = std::thread(&rpc_server::tx_proxy_work, this);
+			/*
+			 * Ingest Server
+			 */
+			if(ingestEndpoint != nullptr) {
+				ingestClients.bind(ingestEndpoint);
+				ingestWorkers.bind(SERVER_ZMQ_INGEST_LOCATION);
+				
+				for(std::size_t i = 0; i < ingestWorkerThreadCount; i++) {
+					ingestWorkerThreads[i] = std::thread(&rpc_server::ingest_work, this, i);
+				}
+				
+				// The same control socket shuts this proxy down
+				ingestProxyThread = std::thread(&rpc_server::proxy_work,
+						this,
+						std::ref(ingestClients),
+						std::ref(ingestWorkers));
+			}
 			
 			/*
 			 * Rx Server
 			 */
+			// Results are sharded by topic between one outgoing buffer per worker
+			rxWorkerThreadCount = processor.outgoing_shard_count();
 			
-			rxWorkerThread = std::thread(&rpc_server::rx_work, this);
+			// Without a replay endpoint, results are numbered but not kept
+			for(std::size_t i = 0; i < rxWorkerThreadCount; i++) {
+				rxHistories[i].set_depth(rxReplayEndpoint != nullptr ? rxReplayDepth : 0);
+			}
+			if(rxReplayEndpoint != nullptr) {
+				rxReplayThread = std::thread(&rpc_server::rx_replay_work, this);
+			}
+			
+			if(rxWorkerThreadCount > 1) {
+				// Bound before the workers connect
+				rxShards.bind(SERVER_ZMQ_RX_LOCATION);
+				if(rxBinaryEndpoint != nullptr) {
+					rxBinaryShards.bind(SERVER_ZMQ_RX_BINARY_LOCATION);
+				}
+				
+				rxWorkersDone = false;
+				rxFanInThread = std::thread(&rpc_server::rx_fan_in, this);
+			}
+			
+			for(std::size_t i = 0; i < rxWorkerThreadCount; i++) {
+				rxWorkerThreads[i] = std::thread(&rpc_server::rx_work, this, i);
+			}
 			
 			isRunning = true;
 		}
@@ -74,17 +345,45 @@ namespace net {
 		if(isRunning) {
 			doExit = true;
 			
-			for(auto& worker : txWorkerThreads) {
-				worker.join();
+			for(std::size_t i = 0; i < txWorkerThreadCount; i++) {
+				txWorkerThreads[i].join();
 			}
 			
-			// Shutdown our routing proxy
+			if(ingestEndpoint != nullptr) {
+				for(std::size_t i = 0; i < ingestWorkerThreadCount; i++) {
+					ingestWorkerThreads[i].join();
+				}
+			}
+			
+			// Shutdown our routing proxies
 			/** \todo I believe this also closes txWorkers socket, but need to check */
 			txControl.send("TERMINATE", 9);
 			txControl.unbind(SERVER_ZMQ_CONTROL_LOCATION);
-			txProxyThread.join();
+			if(!txDirect) {
+				txProxyThread.join();
+			}
+			if(ingestEndpoint != nullptr) {
+				ingestProxyThread.join();
+			}
+			
+			for(std::size_t i = 0; i < rxWorkerThreadCount; i++) {
+				rxWorkerThreads[i].join();
+			}
+			
+			if(rxReplayEndpoint != nullptr) {
+				rxReplayThread.join();
+			}
 			
-			rxWorkerThread.join();
+			// The fan in thread publishes what the workers have left behind first
+			if(rxWorkerThreadCount > 1) {
+				rxWorkersDone = true;
+				rxFanInThread.join();
+				
+				rxShards.unbind(SERVER_ZMQ_RX_LOCATION);
+				if(rxBinaryEndpoint != nullptr) {
+					rxBinaryShards.unbind(SERVER_ZMQ_RX_BINARY_LOCATION);
+				}
+			}
 			
 			//delete rxEndpoint;
 			//rxEndpoint = 0;
@@ -94,155 +393,617 @@ namespace net {
 		}
 	}
 	
-	void rpc_server::rx_work() {
-		// Context is threadsafe
-		zmq::socket_t socket(context, ZMQ_PUB);
-		socket.bind(rxEndpoint);
+	void rpc_server::rx_work(const std::size_t shard) {
+		// Context is threadsafe. A single worker publishes itself, and XPUB tells it
+		// which topics are subscribed to. Several workers push to the fan in thread.
+		const bool fanIn = (rxWorkerThreadCount > 1);
+		zmq::socket_t socket(context, (fanIn ? ZMQ_PUSH : ZMQ_XPUB));
+		zmq::socket_t binarySocket(context, (fanIn ? ZMQ_PUSH : ZMQ_XPUB));
+		if(fanIn) {
+			socket.connect(SERVER_ZMQ_RX_LOCATION);
+			if(rxBinaryEndpoint != nullptr) {
+				binarySocket.connect(SERVER_ZMQ_RX_BINARY_LOCATION);
+			}
+		} else {
+			socket.bind(rxEndpoint);
+			if(rxBinaryEndpoint != nullptr) {
+				binarySocket.bind(rxBinaryEndpoint);
+			}
+		}
+		rx_history& history = rxHistories[shard];
 		
-		processor.outgoing_buffer().set_push_wait_threshold(1);
+		outgoingBuffer_t& outgoing = processor.outgoing_buffer(shard);
+		outgoing.set_push_wait_threshold(1);
 		std::size_t emptyCount = 0;
 		std::size_t emptyCountThreshold = 2;
 		
+		// Batches that wait must be looked at before their latency is over
+		const std::size_t waitFor = (rxBatchLatency > 0 && rxBatchLatency < RPC_SERVER_RX_THREAD_WAIT_FOR
+				? rxBatchLatency
+				: RPC_SERVER_RX_THREAD_WAIT_FOR);
+		
+		// Kept across iterations, so popping does not build a new queue every time
+		std::queue<push_message> localValues;
+		
+		// Kept across iterations as well, so a topic only allocates its batch once
+		std::unordered_map<push_message::topic_t, rx_batch> batches;
+		auto publish = [&] (rx_batch& batch) {
+			rx_send(socket, binarySocket, batch.items.data(), batch.items.size());
+			batch.items.clear();
+		};
+		
 		while(!doExit) {
-			if(processor.outgoing_buffer().push_wait(RPC_SERVER_RX_THREAD_WAIT_FOR) ||
-					++emptyCount >= emptyCountThreshold) {
+			if(outgoing.push_wait(rxIdle, waitFor) ||
+					(rxIdle.mode() == idle_mode::park && ++emptyCount >= emptyCountThreshold)) {
 				emptyCount = 0;
 				
 				// This is a safe call, if the outgoing_buffer is empty, our localValues
 				// will have a size equal to 0, which is caught by the loop below
-				auto localValues = processor.outgoing_buffer().pop_all();
+				outgoing.pop_all(localValues);
 				
 				while(localValues.size() != 0) {
 					// This is to get around an oversight in the C++11 standard where our
 					// std::queue cannot get an item from the queue by move, only by
 					// reference. This is safe because this we hold the only copy of this
 					// queue so we know nothing will change between front() and pop().
-					auto item = new push_message(std::move(const_cast<push_message&>(localValues.front())));
+					auto item = rxPool.make(std::move(const_cast<push_message&>(localValues.front())));
 					localValues.pop();
 					
+					// Each topic belongs to a single worker, so it is numbered in order
+					history.record_message(*item);
+					
 					logger->put(::action::rx,
 							item->json_data(),
 							item->get_json_size());
 					
+					if(rxBatchSize == 1) {
+						rx_send(socket, binarySocket, &item, 1);
+						continue;
+					}
 					
-					// The topic is a numeric so copying is not a big deal
-					socket.send(item->topic_ch(),
-							sizeof(push_message::topic_t),
-							ZMQ_SNDMORE);
+					rx_batch& batch = batches[item->topic()];
+					if(batch.items.empty()) {
+						batch.first = std::chrono::steady_clock::now();
+					}
+					batch.items.push_back(item);
 					
-					socket.send(::zmq::message_t((void*)item->json_data(),
-							item->get_json_size()+1,
-							// This conforms to the requirement imposed by zmq::message_t
-							// zero-copy idiom that passes a pointer to the data along
-							// with a hint object. Because our data is within the hint
-							// object, we just deallocate the hint object, which is our
-							// case is a request object. The use of the idiom ensures we
-							// do not copy the data of a request in zmq and rather we tell
-							// zmq the buffer is safe to use until the message is sent.
-							// This function is then called automatically to delete the
-							// request object.
-							[] (void* data, void* hint) {
-								UNUSED(data);
-								delete static_cast<push_message*>(hint);
-							},
-							item));
+					if(batch.items.size() >= rxBatchSize) {
+						publish(batch);
+					}
+				}
+			}
+			
+			if(!fanIn) {
+				rx_subscribe(socket);
+				if(rxBinaryEndpoint != nullptr) {
+					rx_subscribe(binarySocket);
+				}
+			}
+			
+			// Without a latency, every batch is published at the end of the drain cycle
+			if(!batches.empty()) {
+				const auto due = std::chrono::steady_clock::now() -
+						std::chrono::milliseconds(rxBatchLatency);
+				for(auto& i : batches) {
+					if(!i.second.items.empty() && i.second.first <= due) {
+						publish(i.second);
+					}
 				}
 			}
 		}
 		
-		socket.disconnect(rxEndpoint);
+		for(auto& i : batches) {
+			if(!i.second.items.empty()) {
+				publish(i.second);
+			}
+		}
+		
+		if(fanIn) {
+			socket.disconnect(SERVER_ZMQ_RX_LOCATION);
+			if(rxBinaryEndpoint != nullptr) {
+				binarySocket.disconnect(SERVER_ZMQ_RX_BINARY_LOCATION);
+			}
+		} else {
+			socket.disconnect(rxEndpoint);
+			if(rxBinaryEndpoint != nullptr) {
+				binarySocket.unbind(rxBinaryEndpoint);
+			}
+		}
 	}
 	
-	void rpc_server::tx_work(const std::size_t txWorkerId) {
-		UNUSED(txWorkerId);
+	void rpc_server::rx_fan_in() {
+		// Context is threadsafe. XPUB tells us which topics are subscribed to.
+		zmq::socket_t socket(context, ZMQ_XPUB);
+		socket.bind(rxEndpoint);
+		
+		zmq::socket_t binarySocket(context, ZMQ_XPUB);
+		if(rxBinaryEndpoint != nullptr) {
+			binarySocket.bind(rxBinaryEndpoint);
+		}
+		
+		::zmq::pollitem_t items[4] = {
+				{(void*)rxShards, 0, ZMQ_POLLIN, 0},
+				{(void*)socket, 0, ZMQ_POLLIN, 0},
+				{(void*)rxBinaryShards, 0, ZMQ_POLLIN, 0},
+				{(void*)binarySocket, 0, ZMQ_POLLIN, 0}
+		};
+		const int itemCount = (rxBinaryEndpoint != nullptr ? 4 : 2);
+		
+		while(!rxWorkersDone) {
+			::zmq::poll(items, itemCount, RPC_SERVER_RX_THREAD_WAIT_FOR);
+			
+			rx_forward(rxShards, socket);
+			rx_subscribe(socket);
+			if(rxBinaryEndpoint != nullptr) {
+				rx_forward(rxBinaryShards, binarySocket);
+				rx_subscribe(binarySocket);
+			}
+		}
+		
+		// The workers have returned, so whatever they have pushed is waiting for us
+		rx_forward(rxShards, socket);
+		if(rxBinaryEndpoint != nullptr) {
+			rx_forward(rxBinaryShards, binarySocket);
+		}
 		
+		socket.unbind(rxEndpoint);
+		if(rxBinaryEndpoint != nullptr) {
+			binarySocket.unbind(rxBinaryEndpoint);
+		}
+	}
+	
+	void rpc_server::rx_forward(::zmq::socket_t& from, ::zmq::socket_t& to) {
+		// A worker pushes whole messages, so their frames arrive one after the other
+		::zmq::message_t msg;
+		while(from.recv(&msg, ZMQ_DONTWAIT)) {
+			to.send(msg, (msg.more() ? ZMQ_SNDMORE : 0));
+		}
+	}
+	
+	void rpc_server::rx_replay_work() {
 		// Context is threadsafe
 		zmq::socket_t socket(context, ZMQ_REP);
+		socket.bind(rxReplayEndpoint);
+		socket.setsockopt(ZMQ_RCVTIMEO, &rx_replay_receive_timeout, sizeof(rx_replay_receive_timeout));
+		
+		// Reused for every request
+		request rqst;
+		std::vector<push_message> messages;
+		
+		while(!doExit) {
+			::zmq::message_t msg;
+			if(!socket.recv(&msg)) {
+				continue;
+			}
+			
+			// A request is a single frame, anything else is drained and refused
+			bool valid = !msg.more();
+			while(msg.more()) {
+				socket.recv(&msg);
+			}
+			
+			::zmq::message_t reply;
+			try {
+				if(UNLIKELY(!valid || !rqst.parse(static_cast<char*>(msg.data()), msg.size()))) {
+					throw std::invalid_argument(err_msg::_invldrq);
+				}
+				
+				const str_view method = rqst.method();
+				if(UNLIKELY(action_from_str(method.data, method.size) != action::rx_replay)) {
+					throw std::invalid_argument(err_msg::_unkmthd);
+				}
+				
+				const push_message::topic_t topic = rqst.parameter<unsigned long int>(0);
+				rxHistories[topic % rxWorkerThreadCount].replay(topic,
+						rqst.parameter<unsigned long int>(1),
+						rqst.parameter<unsigned long int>(2),
+						messages);
+				
+				reply = json_reply(new response((unsigned long int)messages.size()));
+			} catch(const std::exception& e) {
+				socket.send(json_reply(new response(e.what(), true)));
+				continue;
+			}
+			
+			// The results follow the count, each in a frame of its own as published
+			socket.send(reply, (messages.empty() ? 0 : ZMQ_SNDMORE));
+			for(std::size_t i = 0; i < messages.size(); i++) {
+				socket.send(messages[i].json_data(),
+						messages[i].get_json_size() + 1,
+						(i + 1 < messages.size() ? ZMQ_SNDMORE : 0));
+			}
+			messages.clear();
+		}
+		
+		socket.unbind(rxReplayEndpoint);
+	}
+	
+	void rpc_server::rx_subscribe(::zmq::socket_t& socket) {
+		::zmq::message_t msg;
+		while(socket.recv(&msg, ZMQ_DONTWAIT)) {
+			processor.rx_subscriptions().update(msg.data(), msg.size());
+		}
+	}
+	
+	void rpc_server::rx_send(::zmq::socket_t& socket,
+			::zmq::socket_t& binarySocket,
+			push_message* const* const items,
+			const std::size_t count) {
+		// Every item has the same topic. Once its frame is sent, zmq may release the
+		// item at any time, so the topic is copied.
+		const push_message::topic_t topic = items[0]->topic();
+		
+		// A result frame is small enough for zmq to keep within the message
+		if(rxBinaryEndpoint != nullptr) {
+			binarySocket.send(&topic, sizeof(topic), ZMQ_SNDMORE);
+			
+			for(std::size_t i = 0; i < count; i++) {
+				::zmq::message_t frame(rx_frame_size(*items[i]));
+				write_rx_frame(static_cast<char*>(frame.data()), *items[i]);
+				binarySocket.send(frame, (i + 1 < count ? ZMQ_SNDMORE : 0));
+			}
+		}
+		
+		// The topic is a numeric so copying is not a big deal
+		socket.send(&topic, sizeof(topic), ZMQ_SNDMORE);
+		
+		for(std::size_t i = 0; i < count; i++) {
+			socket.send(::zmq::message_t((void*)items[i]->json_data(),
+					items[i]->get_json_size()+1,
+					// This conforms to the requirement imposed by zmq::message_t
+					// zero-copy idiom that passes a pointer to the data along with a
+					// hint object. Because our data is within the hint object, we just
+					// release the hint object, which is our case is a push_message,
+					// back into the pool. The use of the idiom ensures we do not copy
+					// the data of a message in zmq and rather we tell zmq the buffer is
+					// safe to use until the message is sent. This function is then
+					// called automatically, from a zmq thread, to release the message.
+					[] (void* data, void* hint) {
+						UNUSED(data);
+						rxPool.release(static_cast<push_message*>(hint));
+					},
+					items[i]),
+					(i + 1 < count ? ZMQ_SNDMORE : 0));
+		}
+	}
+	
+	void rpc_server::tx_work(const std::size_t txWorkerId) {
+		UNUSED(txWorkerId);
+		
+		// Context is threadsafe. Unlike REP, DEALER lets us receive the next request
+		// before replying to the last one.
+		zmq::socket_t socket(context, ZMQ_DEALER);
 		socket.connect(SERVER_ZMQ_WORKER_LOCATION);
-		socket.setsockopt(ZMQ_RCVTIMEO, &tx_receive_timeout, sizeof(tx_receive_timeout));
 		socket.setsockopt(ZMQ_SNDTIMEO, &tx_send_timeout, sizeof(tx_send_timeout));
 		
+		tx_serve(socket);
+		
+		socket.disconnect(SERVER_ZMQ_WORKER_LOCATION);
+	}
+	
+	void rpc_server::tx_serve(::zmq::socket_t& socket) {
+		// Reused for every request, so neither parsing nor routing allocates
+		request request;
+		binary_request binaryRequest;
+		std::vector<::zmq::message_t> envelope;
+		
+		// Tickets completed by the processor wake us through their queue
+		std::shared_ptr<ticket_queue> tickets;
+		std::vector<ticket*> completed;
+		if(txDeferred) {
+			tickets = std::make_shared<ticket_queue>();
+		}
+		
+		::zmq::pollitem_t items[2] = {
+				{(void*)socket, 0, ZMQ_POLLIN, 0},
+				{nullptr, (tickets ? tickets->fd() : -1), ZMQ_POLLIN, 0}
+		};
+		const int itemCount = (tickets ? 2 : 1);
+		
 		while(!doExit) {
-			response* reply = 0;
-			zmq::message_t requestMsg;
-			// Wait to receive request from client
-			if(socket.recv(&requestMsg)) {
-				// Process
-				request request(static_cast<char* const>(requestMsg.data()));
+			::zmq::poll(items, itemCount, tx_receive_timeout);
+			
+			if(tickets && (items[1].revents & ZMQ_POLLIN)) {
+				tickets->take(completed);
+				for(auto tkt : completed) {
+					::zmq::message_t reply(tkt->binary
+							? binary_reply(tkt->header, NET_BINARY_HEADER_SIZE, tkt->error)
+							: (tkt->error == nullptr
+									? static_reply(okJson)
+									: json_reply(new response(tkt->error, true))));
+					send_reply(socket, tkt->envelope, reply);
+					delete tkt;
+				}
+				completed.clear();
+			}
+			
+			if(!(items[0].revents & ZMQ_POLLIN)) {
+				continue;
+			}
+			
+			// Replies to completed tickets wait for at most a burst of requests
+			for(std::size_t i = 0; i < RPC_SERVER_TX_BURST; i++) {
+				zmq::message_t requestMsg;
+				if(!receive_request(socket, envelope, requestMsg)) {
+					break;
+				}
 				
-				if(strcmp(request.method(), action_str(action::configure_node)) == 0) {
-					// Avoid null terminator
-					logger->put(::action::configure_node,
-							requestMsg.data(),
-							requestMsg.size()-1);
-					
-					auto newItem = processor.preprocess(action::configure_node,
-							ntohl(request.parameter<unsigned int>(0)),
-							request.parameter<const char*>(1),
-							request.parameter<const char*>(2),
-							request.parameter<const char*>(3),
-							request.parameter<char>(4));
-					
-					processor.incoming_buffer().push(std::move(newItem));
-					
-					reply = new response(true);
-				} else if(strcmp(request.method(), action_str(action::tx)) == 0) {
-					// Transmit data
-					// Avoid null terminator
-					logger->put(::action::tx,
-							requestMsg.data(), 
-							requestMsg.size()-1);
-					
-					processor.incoming_buffer().push(processor.preprocess(action::tx,
-							ntohl(request.parameter<unsigned int>(0)),
-							"",
-							request.parameter<const char*>(1),
-							request.parameter<const char*>(2),
-							request.parameter<const char*>(3)[0]));
-					
-					reply = new response(true);
-				} else if(strcmp(request.method(), action_str(action::configure_qswitch)) == 0) {
-					// Avoid null terminator
-					logger->put(::action::configure_qswitch,
-							requestMsg.data(),
-							requestMsg.size()-1);
-					
-					reply = new response(true);
-					//\todo: fix this up 
-					processor.incoming_buffer().push(processor.preprocess(action::configure_node,
-							ntohl(request.parameter<unsigned int>(0)),
-							"routing",
-							request.parameter<const char*>(1),
-							request.parameter<const char*>(2),
-							0));
-					reply = new response(true);
+				ticket* const tkt = (tickets
+						? new ticket(tickets, std::move(envelope), requestMsg)
+						: nullptr);
+				
+				::zmq::message_t reply;
+				if(tx_reply(request, binaryRequest, requestMsg, tkt, reply)) {
+					send_reply(socket, (tkt ? tkt->envelope : envelope), reply);
+					delete tkt;
+				}
+			}
+		}
+		
+		if(tickets) {
+			// Tickets completed from now on are simply deleted
+			tickets->close();
+		}
+	}
+	
+	bool rpc_server::tx_reply(request& rqst,
+			binary_request& binaryRqst,
+			::zmq::message_t& msg,
+			ticket* const tkt,
+			::zmq::message_t& reply) {
+		const char* const data = static_cast<const char*>(msg.data());
+		if(msg.size() != 0 && (unsigned char)data[0] == NET_BINARY_MAGIC) {
+			return tx_binary(binaryRqst, msg, tkt, reply);
+		}
+		
+		return tx_json(rqst, msg, tkt, reply);
+	}
+	
+	action rpc_server::tx_decode(request& rqst, ::zmq::message_t& msg) {
+		if(UNLIKELY(!rqst.parse(static_cast<char* const>(msg.data()), msg.size()))) {
+			throw std::invalid_argument(err_msg::_invldrq);
+		}
+		
+		// A perfect hash finds the handler with a single string comparison
+		const str_view method = rqst.method();
+		const action A = action_from_str(method.data, method.size);
+		if(UNLIKELY(A == action::_COUNT ||
+				(txHandlers[enum_value<action>(A)] == nullptr && A != action::tx_batch))) {
+			throw std::invalid_argument(err_msg::_unkmthd);
+		}
+		
+		// Avoid null terminator
+		logger->put(A, msg.data(), msg.size()-1);
+		
+		return A;
+	}
+	
+	action rpc_server::tx_decode(binary_request& rqst, const ::zmq::message_t& msg) {
+		const char* const data = static_cast<const char*>(msg.data());
+		if(UNLIKELY(!rqst.parse(data, msg.size()))) {
+			throw std::invalid_argument(err_msg::_invldrq);
+		}
+		
+		const action A = rqst.method();
+		if(UNLIKELY(A == action::_COUNT || txBinaryHandlers[enum_value<action>(A)] == nullptr)) {
+			throw std::invalid_argument(err_msg::_unkmthd);
+		}
+		
+		logger->put_binary(A, data, msg.size());
+		
+		return A;
+	}
+	
+	bool rpc_server::tx_json(request& rqst,
+			::zmq::message_t& msg,
+			::completion* const done,
+			::zmq::message_t& reply) {
+		try {
+			const action A = tx_decode(rqst, msg);
+			if(A == action::tx_batch) {
+				reply = json_reply(tx_batch(rqst, msg));
+				return true;
+			}
+			
+			(this->*txHandlers[enum_value<action>(A)])(rqst, msg, done);
+		} catch(const overload_error& e) {
+			// Nothing was queued, so the client may simply try again later
+			reply = json_reply(new response(e.what(), e.retry_after()));
+			return true;
+		} catch(const std::exception& e) {
+			// A bad request must not take the worker down with it, and the client is
+			// owed a reply either way
+			reply = json_reply(new response(e.what(), true));
+			return true;
+		}
+		
+		if(done != nullptr) {
+			return false;
+		}
+		
+		reply = static_reply(okJson);
+		return true;
+	}
+	
+	bool rpc_server::tx_binary(binary_request& rqst,
+			::zmq::message_t& msg,
+			::completion* const done,
+			::zmq::message_t& reply) {
+		// The handler takes the message, so we keep the header for the reply
+		char header[NET_BINARY_HEADER_SIZE];
+		const std::size_t headerSize = std::min<std::size_t>(msg.size(), NET_BINARY_HEADER_SIZE);
+		memcpy(header, msg.data(), headerSize);
+		
+		try {
+			const action A = tx_decode(rqst, msg);
+			(this->*txBinaryHandlers[enum_value<action>(A)])(rqst, msg, done);
+		} catch(const overload_error& e) {
+			reply = binary_reply(header, headerSize, e.what(), &e);
+			return true;
+		} catch(const std::exception& e) {
+			reply = binary_reply(header, headerSize, e.what());
+			return true;
+		}
+		
+		if(done != nullptr) {
+			return false;
+		}
+		
+		reply = binary_reply(header, headerSize, nullptr);
+		return true;
+	}
+	
+	void rpc_server::ingest_work(const std::size_t ingestWorkerId) {
+		UNUSED(ingestWorkerId);
+		
+		// Context is threadsafe
+		zmq::socket_t socket(context, ZMQ_PULL);
+		socket.connect(SERVER_ZMQ_INGEST_LOCATION);
+		socket.setsockopt(ZMQ_RCVTIMEO, &ingest_receive_timeout, sizeof(ingest_receive_timeout));
+		
+		// Reused for every request, so parsing does not allocate
+		request request;
+		binary_request binaryRequest;
+		
+		while(!doExit) {
+			zmq::message_t requestMsg;
+			if(!socket.recv(&requestMsg)) {
+				continue;
+			}
+			
+			// Nobody waits for a reply, so only errors are sent back
+			const char* const data = static_cast<const char*>(requestMsg.data());
+			try {
+				if(requestMsg.size() != 0 && (unsigned char)data[0] == NET_BINARY_MAGIC) {
+					const action A = tx_decode(binaryRequest, requestMsg);
+					(this->*txBinaryHandlers[enum_value<action>(A)])(binaryRequest, requestMsg, nullptr);
 				} else {
-					// Invalid method request
-					throw std::runtime_error(err_msg::_undhcse);
+					const action A = tx_decode(request, requestMsg);
+					if(UNLIKELY(A == action::tx_batch)) {
+						// The status of each transmission is only available as a reply
+						throw std::invalid_argument(err_msg::_unkmthd);
+					}
+					
+					(this->*txHandlers[enum_value<action>(A)])(request, requestMsg, nullptr);
 				}
-				
-				// Send Response
-				socket.send(::zmq::message_t((void*)reply->get_json(),
-						reply->get_json_size(),
-						[] (void* data, void* hint) {
-							UNUSED(data);
-							delete static_cast<response*>(hint);
-						},
-						reply));
+			} catch(const std::exception& e) {
+				ingest_error(e.what());
 			}
 		}
 		
-		socket.disconnect(SERVER_ZMQ_WORKER_LOCATION);
+		socket.disconnect(SERVER_ZMQ_INGEST_LOCATION);
+	}
+	
+	void rpc_server::ingest_error(const char* const error) {
+		// The rx worker owns the publisher, so errors take the same way as results
+		processor.push_outgoing(push_message(RPC_SERVER_INGEST_ERROR_TOPIC, error, 0));
+	}
+	
+	template <typename R> void rpc_server::tx_configure_node(const R& rqst,
+			::zmq::message_t& msg,
+			::completion* const done) {
+		// Configuration is never turned away, so it takes effect however busy we are
+		processor.incoming_buffer().push(processor.preprocess(action::configure_node,
+				node_of(rqst),
+				std::move(msg),
+				rqst.template parameter<const char*>(1),
+				rqst.template parameter<const char*>(2),
+				rqst.template parameter<const char*>(3),
+				rqst.template parameter<char>(4),
+				done));
+	}
+	
+	template <typename R> void rpc_server::tx_transmit(const R& rqst,
+			::zmq::message_t& msg,
+			::completion* const done) {
+		// Read before the request takes done, which a failure must leave alone
+		std::uint_fast64_t wallDeadline, simDeadline;
+		deadline_of(rqst, wallDeadline, simDeadline);
+		
+		interpreted_request item(processor.preprocess(action::tx,
+				node_of(rqst),
+				std::move(msg),
+				"",
+				rqst.template parameter<const char*>(1),
+				rqst.template parameter<const char*>(2),
+				rqst.template parameter<char>(3),
+				done));
+		item.set_deadline(wallDeadline, simDeadline);
+		
+		processor.admit(std::move(item));
+	}
+	
+	response* rpc_server::tx_batch(const request& rqst, const ::zmq::message_t& msg) {
+		const std::size_t size = rqst.parameter_size(0);
+		if(UNLIKELY(size == 0 ||
+				rqst.parameter_size(1) != size ||
+				rqst.parameter_size(2) != size ||
+				rqst.parameter_size(3) != size)) {
+			throw std::invalid_argument(err_msg::_invldrq);
+		}
+		
+		std::uint_fast64_t wallDeadline, simDeadline;
+		deadline_of(rqst, wallDeadline, simDeadline);
+		
+		std::vector<interpreted_request> batch;
+		batch.reserve(size);
+		std::unique_ptr<bool[]> status(new bool[size]);
+		
+		for(std::size_t i = 0; i < size; i++) {
+			// Strings are decoded in place, which must happen before the message is
+			// copied
+			const unsigned int node = ntohl(rqst.element<unsigned int>(0, i));
+			const char* const dialect = rqst.element<const char*>(1, i);
+			const char* const circuit = rqst.element<const char*>(2, i);
+			const char delimiter = rqst.element<char>(3, i);
+			
+			// Every transmission shares the message, which zmq reference counts
+			::zmq::message_t shared;
+			shared.copy(&msg);
+			
+			// A transmission from an unknown node fails on its own
+			try {
+				batch.push_back(processor.preprocess(action::tx,
+						node,
+						std::move(shared),
+						"",
+						dialect,
+						circuit,
+						delimiter));
+				batch.back().set_deadline(wallDeadline, simDeadline);
+				status[i] = true;
+			} catch(const std::out_of_range&) {
+				status[i] = false;
+			}
+		}
+		
+		processor.admit_all(batch);
+		
+		return new response(status.get(), size);
+	}
+	
+	template <typename R> void rpc_server::tx_configure_qswitch(const R& rqst,
+			::zmq::message_t& msg,
+			::completion* const done) {
+		//\todo: fix this up 
+		processor.incoming_buffer().push(processor.preprocess(action::configure_node,
+				node_of(rqst),
+				std::move(msg),
+				"routing",
+				rqst.template parameter<const char*>(1),
+				rqst.template parameter<const char*>(2),
+				0,
+				done));
 	}
 	
-	void rpc_server::tx_proxy_work() {
+	void rpc_server::proxy_work(::zmq::socket_t& frontend, ::zmq::socket_t& backend) {
 		// We listen for control signals for our proxy on this socket
 		::zmq::socket_t controlSub = ::zmq::socket_t(context, ZMQ_SUB);
 		controlSub.setsockopt(ZMQ_SUBSCRIBE, "", 0);
 		controlSub.connect(SERVER_ZMQ_CONTROL_LOCATION);
 		
 		// We block until the control socket receives a TERMINATE command
-		zmq::proxy_steerable((void*)txClients, (void*)txWorkers, 0, (void*)controlSub);
+		zmq::proxy_steerable((void*)frontend, (void*)backend, 0, (void*)controlSub);
 		
 		controlSub.disconnect(SERVER_ZMQ_CONTROL_LOCATION);
 	}
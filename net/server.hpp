@@ -5,11 +5,24 @@
 #include "../action.hpp"
 #include "../buffer.hpp"
 #include "../diagnostics/logger.hpp"
+#include "../pool.hpp"
 #include "../processor.hpp"
+#include "binary_request.hpp"
 #include "request.hpp"
 #include "response.hpp"
+#include "rx_frame.hpp"
+#include "rx_history.hpp"
+#include "ticket.hpp"
+#include <algorithm>
 #include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
 #include <mutex>
+#include <queue>
+#include <unordered_map>
+#include <vector>
 #include <zmq.hpp>
 
 /**
@@ -17,10 +30,20 @@
  */
 #define NET_SERVER_MAX_TX_THREADS 16
 
+/**
+ * \brief Maximum number of ingest worker threads that can be launched.
+ */
+#define NET_SERVER_MAX_INGEST_THREADS 16
+
 /**
  * \brief Maximum number of rx worker threads that can be launched.
  */
-#define NET_SERVER_MAX_RX_THREADS 1
+#define NET_SERVER_MAX_RX_THREADS PROCESSOR_MAX_OUTGOING_SHARDS
+
+/**
+ * \brief Maximum number of rx results of a topic published together.
+ */
+#define NET_SERVER_MAX_RX_BATCH 1024
 
 #define RPC_SERVER_RX_THREAD_WAIT_FOR 15 // milliseconds
 #define RPC_SERVER_RX_RECEIVE_TIMEOUT 100 // milliseconds
@@ -36,12 +59,61 @@
  */
 #define RPC_SERVER_TX_SEND_TIMEOUT 100
 
+/**
+ * \brief Maximum number of tx requests a worker receives before sending the replies
+ * the processor has completed in the meantime.
+ */
+#define RPC_SERVER_TX_BURST 32
+
+/**
+ * \brief The index of the optional deadline parameters of a JSON tx or tx_batch
+ * request, which follow the delimiters.
+ */
+#define RPC_SERVER_TX_DEADLINE_PARAMETER 4
+
 /**
  * \brief Internally used zmq socket used for communication between frontend listener and
  * backend workers for tx.
  */
 #define SERVER_ZMQ_WORKER_LOCATION "inproc://workers"
 
+/**
+ * \brief Internally used zmq socket used by rx workers to pass JSON messages on to the
+ * thread that publishes them, when there are several rx workers.
+ */
+#define SERVER_ZMQ_RX_LOCATION "inproc://rx"
+
+/**
+ * \brief Internally used zmq socket used by rx workers to pass binary messages on to the
+ * thread that publishes them, when there are several rx workers.
+ */
+#define SERVER_ZMQ_RX_BINARY_LOCATION "inproc://rx_binary"
+
+/**
+ * \brief Internally used zmq socket used for communication between frontend listener and
+ * backend workers for ingest.
+ */
+#define SERVER_ZMQ_INGEST_LOCATION "inproc://ingest"
+
+/**
+ * \brief Maximum number of milliseconds to block while waiting to receive an ingest
+ * message.
+ */
+#define RPC_SERVER_INGEST_RECEIVE_TIMEOUT 100
+
+/**
+ * \brief Maximum number of milliseconds to block while waiting to receive an rx replay
+ * request.
+ */
+#define RPC_SERVER_RX_REPLAY_RECEIVE_TIMEOUT 100
+
+/**
+ * \brief The rx topic of errors of requests received by the ingest endpoint.
+ * 
+ * No node has this id.
+ */
+#define RPC_SERVER_INGEST_ERROR_TOPIC ((push_message::topic_t)-1)
+
 /**
  * \brief Internally used zmq socket used to signal zmq proxy that binds the frontend
  * listener and the backend workers for tx.
@@ -100,10 +172,95 @@ namespace net {
 		 * \brief Start the server listening with a particular number of listen threads in
 		 * the pool for both rx and tx.
 		 * 
+		 * The processor must already have one outgoing buffer per rx worker, see
+		 * processor::set_outgoing_shards().
+		 * 
 		 * \note Threadsafe
 		 */
 		void listen(const std::size_t rxWorkerCount, const std::size_t txWorkerCount);
 		
+		/**
+		 * \brief Set whether a single tx worker owns the tx socket and handles requests
+		 * itself, instead of a proxy passing requests on to a pool of workers.
+		 * 
+		 * This saves the proxy thread and two inproc hops per request, at the cost of
+		 * handling all tx requests on one thread.
+		 * 
+		 * \warning Must be called before listen().
+		 */
+		void set_direct(const bool direct);
+		
+		/**
+		 * \brief Set whether the reply to a tx or configure request waits until the
+		 * processor has checked the routing of the request.
+		 * 
+		 * Errors the processor finds, e.g. a receiving node without a detector, are then
+		 * returned to the client. Each worker keeps receiving requests while replies
+		 * are pending.
+		 * 
+		 * \warning Must be called before listen().
+		 */
+		void set_deferred(const bool deferred);
+		
+		/**
+		 * \brief Also listen on an ingest endpoint with a particular number of worker
+		 * threads.
+		 * 
+		 * Clients PUSH tx and configure requests to the ingest endpoint without waiting
+		 * for a reply. Requests that fail are published on the rx endpoint under
+		 * RPC_SERVER_INGEST_ERROR_TOPIC instead.
+		 * 
+		 * \warning Must be called before listen().
+		 */
+		void set_ingest(const char* const endpoint, const std::size_t workerCount);
+		
+		/**
+		 * \brief Also publish every rx message as a binary frame on a second endpoint.
+		 * 
+		 * Subscribers select the encoding by the endpoint they connect to. Both
+		 * endpoints use the same topics, followed by JSON on the rx endpoint and by a
+		 * frame carrying a sequence number, the tx timestamp and the result on this
+		 * one, see rx_frame.hpp.
+		 * 
+		 * \warning Must be called before listen().
+		 */
+		void set_rx_binary(const char* const endpoint);
+		
+		/**
+		 * \brief Publish the rx results of a topic together, up to size of them in a
+		 * single message whose first frame is the topic and each further frame a
+		 * result.
+		 * 
+		 * A result waits up to latency milliseconds for others of its topic. Without a
+		 * latency, only results drained from the outgoing buffer at once are published
+		 * together. A size of 1 publishes every result on its own, which is the
+		 * default.
+		 * 
+		 * \warning Must be called before listen().
+		 */
+		void set_rx_batch(const std::size_t size, const std::size_t latency);
+		
+		/**
+		 * \brief Set how the rx threads wait for results, which is to park by default.
+		 * 
+		 * \warning Must be called before listen().
+		 */
+		void set_rx_idle(const idle_strategy& idle);
+		
+		/**
+		 * \brief Keep the last depth rx results of each topic and listen on a replay
+		 * endpoint, where clients fetch results they have missed.
+		 * 
+		 * Every rx result carries a sequence number within its topic, so a subscriber
+		 * that sees a gap asks the replay endpoint with an rx_replay request for the
+		 * topic and the first and last sequence numbers it is missing. The reply is the
+		 * number of results found, followed by each result in a frame of its own as it
+		 * was published. Results that are no longer kept are left out.
+		 * 
+		 * \warning Must be called before listen().
+		 */
+		void set_rx_replay(const char* const endpoint, const std::size_t depth);
+		
 		/**
 		 * \brief Stop the server listening and processing requests.
 		 * 
@@ -142,7 +299,7 @@ namespace net {
 		::processor& processor;
 		::diagnostics::logger* logger;
 		
-				
+		
 		/**
 		 * \brief The zmq context object.
 		 * 
@@ -208,12 +365,12 @@ namespace net {
 		zmq::socket_t txControl;
 		
 		/**
-		 * \brief The thread that runs a zmq proxy that connects our front end listener to
-		 * our backend workers for tx.
+		 * \brief Run a zmq proxy that connects a front end listener to our backend
+		 * workers.
 		 * 
 		 * A zmq control socket is used in stop() that signals this thread to exit.
 		 */
-		void tx_proxy_work();
+		void proxy_work(::zmq::socket_t& frontend, ::zmq::socket_t& backend);
 		
 		/**
 		 * \brief Wait for incoming requests for processing.
@@ -222,21 +379,374 @@ namespace net {
 		 */
 		void tx_work(const std::size_t workerId);
 		
+		/**
+		 * \brief Receive requests with their routing envelopes on a ROUTER or DEALER
+		 * socket and reply to each when it is ready.
+		 * 
+		 * Replies that wait for the processor are sent as it completes their tickets,
+		 * in whatever order that is, while further requests are received.
+		 */
+		void tx_serve(::zmq::socket_t& socket);
+		
+		/**
+		 * \brief Handle a JSON or binary request.
+		 * 
+		 * The requests are reused by each worker. If a ticket is given and the request
+		 * is accepted, the ticket is handed to the processor and the reply waits for it.
+		 * 
+		 * \returns whether reply has been set and must be sent now, in which case the
+		 * ticket is still ours.
+		 */
+		bool tx_reply(request& rqst,
+				binary_request& binaryRqst,
+				::zmq::message_t& msg,
+				ticket* const tkt,
+				::zmq::message_t& reply);
+		
+		/**
+		 * \brief Whether a single tx worker owns txClients, see set_direct().
+		 */
+		bool txDirect;
+		
+		/**
+		 * \brief Whether replies to tx requests wait for the processor, see
+		 * set_deferred().
+		 */
+		bool txDeferred;
+		
+		/**
+		 * \brief The ingest endpoint, or null if there is none.
+		 */
+		const char* ingestEndpoint;
+		
+		/**
+		 * \brief An array of thread objects where each thread is an ingest worker that is
+		 * processing requests.
+		 */
+		std::thread ingestWorkerThreads[NET_SERVER_MAX_INGEST_THREADS];
+		
+		/**
+		 * \brief The number of ingest worker threads.
+		 */
+		std::size_t ingestWorkerThreadCount;
+		
+		/**
+		 * \brief The thread that runs a zmq proxy that connects our front end ingest
+		 * listener to our backend workers.
+		 */
+		std::thread ingestProxyThread;
+		
+		/**
+		 * \brief The front end listener that actually binds to our ingest endpoint.
+		 */
+		zmq::socket_t ingestClients;
+		
+		/**
+		 * \brief An internal socket where requests accepted by the ingest frontend socket
+		 * are passed to the worker threads that are listening.
+		 */
+		zmq::socket_t ingestWorkers;
+		
+		/**
+		 * \brief Maximum number of milliseconds to block with zmq's recv() for ingest.
+		 */
+		static const int ingest_receive_timeout;
+		
+		/**
+		 * \brief Wait for incoming ingest requests for processing.
+		 * 
+		 * \note Threadsafe
+		 */
+		void ingest_work(const std::size_t workerId);
+		
+		/**
+		 * \brief Publish the error of an ingest request under
+		 * RPC_SERVER_INGEST_ERROR_TOPIC.
+		 */
+		void ingest_error(const char* const error);
+		
+		/**
+		 * \brief Parse a JSON request, check that clients may call its method and log
+		 * it.
+		 * 
+		 * \returns the action of the method.
+		 * 
+		 * \throws std::invalid_argument if the request is invalid or its method unknown.
+		 */
+		action tx_decode(request& rqst, ::zmq::message_t& msg);
+		
+		/**
+		 * \brief Parse a binary request, check that clients may call its method and log
+		 * it.
+		 * 
+		 * \returns the action of the method.
+		 * 
+		 * \throws std::invalid_argument if the request is invalid or its method unknown.
+		 */
+		action tx_decode(binary_request& rqst, const ::zmq::message_t& msg);
+		
+		/**
+		 * \brief Handle a JSON request and set the reply, unless done has been handed to
+		 * the processor.
+		 * 
+		 * \returns whether reply has been set.
+		 */
+		bool tx_json(request& rqst,
+				::zmq::message_t& msg,
+				::completion* const done,
+				::zmq::message_t& reply);
+		
+		/**
+		 * \brief Handle a binary request and set the reply, unless done has been handed
+		 * to the processor.
+		 * 
+		 * \returns whether reply has been set.
+		 */
+		bool tx_binary(binary_request& rqst,
+				::zmq::message_t& msg,
+				::completion* const done,
+				::zmq::message_t& reply);
+		
+		/**
+		 * \brief A handler of a tx method for requests of type R, which throws if the
+		 * request cannot be handled.
+		 * 
+		 * Unless it throws, the handler hands the message the request was parsed from
+		 * and done, which may be null, to the processor.
+		 */
+		template <typename R> using tx_handler_t = void (rpc_server::*)(const R& rqst,
+				::zmq::message_t& msg,
+				::completion* const done);
+		
+		/**
+		 * \brief The handler of each action for JSON requests, or null if clients may
+		 * not call it.
+		 * 
+		 * \warning Order must correspond to action.
+		 */
+		static const tx_handler_t<request> txHandlers[ARRAY_LENGTH(_actions)];
+		
+		/**
+		 * \brief The handler of each action for binary requests, or null if clients may
+		 * not call it.
+		 * 
+		 * \warning Order must correspond to action.
+		 */
+		static const tx_handler_t<binary_request> txBinaryHandlers[ARRAY_LENGTH(_actions)];
+		
+		/**
+		 * \brief Return the node id of a JSON request.
+		 */
+		static inline unsigned int node_of(const request& rqst) {
+			return ntohl(rqst.parameter<unsigned int>(0));
+		}
+		
+		/**
+		 * \brief Return the node id of a binary request.
+		 */
+		static inline unsigned int node_of(const binary_request& rqst) {
+			return rqst.node();
+		}
+		
+		/**
+		 * \brief Return the deadline of the transmissions of a JSON request, whose
+		 * optional parameters after the delimiters are the time they may wait in
+		 * milliseconds and the simulation time they go stale at, either 0 for none.
+		 * 
+		 * See interpreted_request::set_deadline().
+		 */
+		static inline void deadline_of(const request& rqst,
+				std::uint_fast64_t& wallDeadline,
+				std::uint_fast64_t& simDeadline) {
+			const std::size_t count = rqst.parameter_count();
+			const std::uint64_t budget = (count > RPC_SERVER_TX_DEADLINE_PARAMETER
+					? rqst.parameter<unsigned long int>(RPC_SERVER_TX_DEADLINE_PARAMETER)
+					: 0);
+			
+			wallDeadline = (budget == 0 ? 0 : ::processor::wall_deadline(budget));
+			simDeadline = (count > RPC_SERVER_TX_DEADLINE_PARAMETER + 1
+					? rqst.parameter<unsigned long int>(RPC_SERVER_TX_DEADLINE_PARAMETER + 1)
+					: 0);
+		}
+		
+		/**
+		 * \brief Return the deadline of the transmission of a binary request.
+		 */
+		static inline void deadline_of(const binary_request& rqst,
+				std::uint_fast64_t& wallDeadline,
+				std::uint_fast64_t& simDeadline) {
+			wallDeadline = (rqst.budget() == 0 ? 0 : ::processor::wall_deadline(rqst.budget()));
+			simDeadline = rqst.sim_deadline();
+		}
+		
+		/**
+		 * \brief Handle a configure_node request.
+		 */
+		template <typename R> void tx_configure_node(const R& rqst,
+				::zmq::message_t& msg,
+				::completion* const done);
+		
+		/**
+		 * \brief Handle a tx request.
+		 */
+		template <typename R> void tx_transmit(const R& rqst,
+				::zmq::message_t& msg,
+				::completion* const done);
+		
+		/**
+		 * \brief Handle a configure_qswitch request.
+		 */
+		template <typename R> void tx_configure_qswitch(const R& rqst,
+				::zmq::message_t& msg,
+				::completion* const done);
+		
+		/**
+		 * \brief Handle a tx_batch request, which returns whether each transmission
+		 * was accepted.
+		 * 
+		 * The parameters are arrays of equal size with the node ids, dialects, circuits
+		 * and delimiters of the transmissions, which are admitted into the incoming
+		 * buffer at once, or turned away at once if they do not fit.
+		 */
+		response* tx_batch(const request& rqst, const ::zmq::message_t& msg);
+		
 		
 		const char* txEndpoint;
 		const char* rxEndpoint;
 		
 		/**
-		 * \brief Thread for rx server.
+		 * \brief The binary rx endpoint, or null if there is none.
 		 */
-		std::thread rxWorkerThread;
+		const char* rxBinaryEndpoint;
 		
 		/**
-		 * \brief Wait for data to become available before pushing it to clients for rx.
+		 * \brief The maximum number of rx results published together, see
+		 * set_rx_batch().
+		 */
+		std::size_t rxBatchSize;
+		
+		/**
+		 * \brief The milliseconds an rx result may wait for others, see set_rx_batch().
+		 */
+		std::size_t rxBatchLatency;
+		
+		/**
+		 * \brief How the rx threads wait for results, see set_rx_idle().
+		 */
+		idle_strategy rxIdle;
+		
+		/**
+		 * \brief The rx results of a topic waiting to be published together.
+		 */
+		struct rx_batch {
+			/**
+			 * \brief The results, which come from the rx pool.
+			 */
+			std::vector<push_message*> items;
+			
+			/**
+			 * \brief When the first result was added.
+			 */
+			std::chrono::steady_clock::time_point first;
+		};
+		
+		/**
+		 * \brief Threads for rx server, each of which publishes the results of an
+		 * outgoing buffer of the processor.
+		 */
+		std::thread rxWorkerThreads[NET_SERVER_MAX_RX_THREADS];
+		
+		/**
+		 * \brief The number of rx worker threads.
+		 */
+		std::size_t rxWorkerThreadCount;
+		
+		/**
+		 * \brief Thread that publishes what several rx workers pass on.
+		 */
+		std::thread rxFanInThread;
+		
+		/**
+		 * \brief Whether the rx workers have all returned, which tells the fan in
+		 * thread to return as well.
+		 */
+		std::atomic_bool rxWorkersDone;
+		
+		/**
+		 * \brief The rx replay endpoint, or null if there is none.
+		 */
+		const char* rxReplayEndpoint;
+		
+		/**
+		 * \brief The number of rx results kept per topic, see set_rx_replay().
+		 */
+		std::size_t rxReplayDepth;
+		
+		/**
+		 * \brief Thread that answers rx replay requests.
+		 */
+		std::thread rxReplayThread;
+		
+		/**
+		 * \brief The sequence numbers and recent results of each rx worker.
+		 */
+		rx_history rxHistories[NET_SERVER_MAX_RX_THREADS];
+		
+		/**
+		 * \brief Maximum number of milliseconds to block with zmq's recv() for rx
+		 * replay.
+		 */
+		static const int rx_replay_receive_timeout;
+		
+		/**
+		 * \brief Sockets the rx workers pass JSON and binary messages on to, when there
+		 * are several of them.
+		 */
+		zmq::socket_t rxShards;
+		zmq::socket_t rxBinaryShards;
+		
+		/**
+		 * \brief Wait for data to become available in an outgoing buffer before pushing
+		 * it to clients for rx.
+		 * 
+		 * A single rx worker publishes itself. Several rx workers pass their messages on
+		 * to rx_fan_in(), which owns the rx endpoints. Either way, each topic is
+		 * published in order, since it belongs to a single outgoing buffer.
 		 * 
 		 * \note Threadsafe
 		 */
-		void rx_work();
+		void rx_work(const std::size_t shard);
+		
+		/**
+		 * \brief Publish the messages that several rx workers pass on.
+		 */
+		void rx_fan_in();
+		
+		/**
+		 * \brief Answer rx replay requests, see set_rx_replay().
+		 */
+		void rx_replay_work();
+		
+		/**
+		 * \brief Pass every message waiting on a socket on to another, without
+		 * blocking.
+		 */
+		void rx_forward(::zmq::socket_t& from, ::zmq::socket_t& to);
+		
+		/**
+		 * \brief Pass the subscriptions an XPUB socket has received on to the
+		 * processor, without blocking.
+		 */
+		void rx_subscribe(::zmq::socket_t& socket);
+		
+		/**
+		 * \brief Publish count results of the same topic in a single message, handing
+		 * them over to zmq.
+		 */
+		void rx_send(::zmq::socket_t& socket,
+				::zmq::socket_t& binarySocket,
+				push_message* const* const items,
+				const std::size_t count);
 	};
 }
 
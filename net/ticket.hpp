@@ -0,0 +1,227 @@
+#ifndef _NET_TICKET_HPP
+#define _NET_TICKET_HPP
+
+#include <common.hpp>
+#include "../buffer.hpp"
+#include "binary_request.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <zmq.hpp>
+
+namespace net {
+	// Forward declaration
+	struct ticket;
+	
+	/**
+	 * \brief The tickets of a tx worker that have been completed by the processor and
+	 * are waiting to be replied to.
+	 * 
+	 * Processor threads add tickets and signal an eventfd, which the worker polls
+	 * together with its socket.
+	 */
+	struct ticket_queue {
+	 public:
+		/**
+		 * \brief Constructor.
+		 */
+		ticket_queue()
+				: _fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+				_closed(false) {
+			if(UNLIKELY(_fd == -1)) {
+				throw std::runtime_error("Could not create eventfd");
+			}
+		}
+		
+		/**
+		 * \brief Copy constructor is disabled.
+		 */
+		ticket_queue(const ticket_queue&) = delete;
+		
+		/**
+		 * \brief Assignment operator is disabled.
+		 */
+		ticket_queue& operator=(const ticket_queue&) = delete;
+		
+		/**
+		 * \brief Destructor.
+		 */
+		~ticket_queue() {
+			close();
+			::close(_fd);
+		}
+		
+		/**
+		 * \brief Return the file descriptor that is readable while tickets are waiting.
+		 */
+		inline int fd() const {
+			return _fd;
+		}
+		
+		/**
+		 * \brief Add a completed ticket and wake the worker, or delete the ticket if the
+		 * worker has gone.
+		 * 
+		 * \note Threadsafe
+		 */
+		inline void push(ticket* const tkt);
+		
+		/**
+		 * \brief Move the completed tickets into tickets, which must be empty.
+		 * 
+		 * \note Threadsafe
+		 */
+		inline void take(std::vector<ticket*>& tickets) {
+			// This resets the eventfd
+			std::uint64_t count;
+			const ssize_t rc = read(_fd, &count, sizeof(count));
+			UNUSED(rc);
+			
+			std::lock_guard<std::mutex> lock(_mutex);
+			std::swap(_tickets, tickets);
+		}
+		
+		/**
+		 * \brief Delete the waiting tickets and every ticket completed from now on,
+		 * because the worker has gone.
+		 * 
+		 * \note Threadsafe
+		 */
+		inline void close();
+	
+	 private:
+		/**
+		 * \brief Mutex to protect the tickets.
+		 */
+		std::mutex _mutex;
+		
+		/**
+		 * \brief The completed tickets.
+		 */
+		std::vector<ticket*> _tickets;
+		
+		/**
+		 * \brief The eventfd signalled for every ticket pushed.
+		 */
+		const int _fd;
+		
+		/**
+		 * \brief Whether the worker has gone.
+		 */
+		bool _closed;
+	};
+	
+	/**
+	 * \brief A tx request whose reply waits for the processor.
+	 * 
+	 * The ticket holds what it takes to reply to the client: the routing envelope and,
+	 * for a binary request, its header.
+	 */
+	struct ticket : public ::completion {
+	 public:
+		/**
+		 * \brief Constructor takes the routing envelope and the request.
+		 */
+		ticket(const std::shared_ptr<ticket_queue>& queue,
+				std::vector<::zmq::message_t>&& envelope,
+				const ::zmq::message_t& msg)
+				: envelope(std::move(envelope)),
+				binary(msg.size() != 0 &&
+						*static_cast<const unsigned char*>(msg.data()) == NET_BINARY_MAGIC),
+				error(nullptr),
+				_queue(queue) {
+			if(binary) {
+				memcpy(header,
+						msg.data(),
+						std::min<std::size_t>(msg.size(), NET_BINARY_HEADER_SIZE));
+			}
+		}
+		
+		/**
+		 * \brief Copy constructor is disabled.
+		 */
+		ticket(const ticket&) = delete;
+		
+		/**
+		 * \brief Assignment operator is disabled.
+		 */
+		ticket& operator=(const ticket&) = delete;
+		
+		/**
+		 * \brief Hand the ticket back to its worker.
+		 */
+		void complete(const char* const error) override {
+			this->error = error;
+			
+			// The queue may delete us, so we keep it alive until we return
+			std::shared_ptr<ticket_queue> queue(_queue);
+			queue->push(this);
+		}
+		
+		/**
+		 * \brief The routing envelope of the request.
+		 */
+		std::vector<::zmq::message_t> envelope;
+		
+		/**
+		 * \brief Whether the request is binary.
+		 */
+		const bool binary;
+		
+		/**
+		 * \brief The header of a binary request.
+		 */
+		char header[NET_BINARY_HEADER_SIZE];
+		
+		/**
+		 * \brief The error message once completed, or null.
+		 */
+		const char* error;
+	
+	 private:
+		/**
+		 * \brief The queue of the worker that waits for us.
+		 */
+		std::shared_ptr<ticket_queue> _queue;
+	};
+	
+	inline void ticket_queue::push(ticket* const tkt) {
+		bool closed;
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			closed = _closed;
+			if(!closed) {
+				_tickets.push_back(tkt);
+			}
+		}
+		
+		if(closed) {
+			delete tkt;
+			return;
+		}
+		
+		const std::uint64_t one = 1;
+		const ssize_t rc = write(_fd, &one, sizeof(one));
+		UNUSED(rc);
+	}
+	
+	inline void ticket_queue::close() {
+		std::vector<ticket*> tickets;
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_closed = true;
+			std::swap(_tickets, tickets);
+		}
+		
+		for(auto tkt : tickets) {
+			delete tkt;
+		}
+	}
+}
+
+#endif
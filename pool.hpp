@@ -0,0 +1,121 @@
+#ifndef _POOL_HPP
+#define _POOL_HPP
+
+#include <common.hpp>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**
+ * \brief The number of objects allocated at once when a pool runs out.
+ */
+#define POOL_SLAB_SIZE 256
+
+/**
+ * \brief A pool of objects allocated in slabs, which are never given back.
+ * 
+ * Once the pool has grown to the largest number of objects alive at once, making and
+ * releasing an object no longer allocates. Objects may be released by another thread
+ * than the one that made them, e.g. by a zmq free function.
+ * 
+ * \warning Objects still alive when the pool is destroyed are not destroyed, so the
+ * pool must outlive every zmq message that refers to its objects.
+ */
+template <typename T> class pool {
+ private:
+	typedef std::lock_guard<std::mutex> lock_t;
+	typedef typename std::aligned_storage<sizeof(T), alignof(T)>::type slot_t;
+
+ public:
+	/**
+	 * \brief Constructor.
+	 */
+	pool() {
+	}
+	
+	/**
+	 * \brief Copy constructor is disabled.
+	 */
+	pool(const pool&) = delete;
+	
+	/**
+	 * \brief Assignment operator is disabled.
+	 */
+	pool& operator=(const pool&) = delete;
+	
+	/**
+	 * \brief Construct an object from args in a free slot.
+	 * 
+	 * \note Threadsafe
+	 */
+	template <typename... Args> inline T* make(Args&&... args) {
+		slot_t* slot;
+		{
+			lock_t lock(_mutex);
+			
+			if(UNLIKELY(_free.empty())) {
+				_grow();
+			}
+			
+			slot = _free.back();
+			_free.pop_back();
+		}
+		
+		try {
+			return new (slot) T(std::forward<Args>(args)...);
+		} catch(...) {
+			lock_t lock(_mutex);
+			_free.push_back(slot);
+			throw;
+		}
+	}
+	
+	/**
+	 * \brief Destroy an object made by us and free its slot.
+	 * 
+	 * \note Threadsafe
+	 */
+	inline void release(T* const item) {
+		item->~T();
+		
+		lock_t lock(_mutex);
+		_free.push_back(reinterpret_cast<slot_t*>(item));
+	}
+
+ private:
+	/**
+	 * \brief Mutex to protect the slabs and the free slots.
+	 */
+	std::mutex _mutex;
+	
+	/**
+	 * \brief Every slab allocated so far.
+	 */
+	std::vector<std::unique_ptr<slot_t[]>> _slabs;
+	
+	/**
+	 * \brief The free slots.
+	 */
+	std::vector<slot_t*> _free;
+	
+	/**
+	 * \brief Allocate another slab and free its slots.
+	 * 
+	 * The free slots are reserved for every slot there is, so releasing an object
+	 * never allocates.
+	 */
+	inline void _grow() {
+		_slabs.emplace_back(new slot_t[POOL_SLAB_SIZE]);
+		_free.reserve(_slabs.size() * POOL_SLAB_SIZE);
+		
+		slot_t* const slab = _slabs.back().get();
+		for(std::size_t i = 0; i < POOL_SLAB_SIZE; i++) {
+			_free.push_back(&slab[i]);
+		}
+	}
+};
+
+#endif
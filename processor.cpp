@@ -1,25 +1,27 @@
 #include "processor.hpp"
 
 processor::processor(::diagnostics::logger* const logger,
-		const char* const simulatorEndpoint,
+		const std::vector<std::string>& simulatorEndpoints,
 		model::state& state,
 		::zmq::context_t& context)
 		: logger(logger),
 		st(state), 
-		simulatorClientPool(context),
+		outgoingShardCount(1),
+		simulatorBalancer(context),
+		skipUnobserved(false),
+		nodeCapacity(0),
+		retryAfter(PROCESSOR_RETRY_AFTER),
+		expiredCount(0),
 		threadCount(0),
 		isRunning(false),
 		doExit(false) {
-	this->simulatorEndpoint = new char[strlen(simulatorEndpoint) + 1];
-	strcpy(this->simulatorEndpoint, simulatorEndpoint);
+	for(auto& endpoint : simulatorEndpoints) {
+		simulatorBalancer.add_endpoint(endpoint.c_str());
+	}
 }
 
 processor::~processor() {
 	stop();
-	
-	if(simulatorEndpoint != 0) {
-		delete[] simulatorEndpoint;
-	}
 }
 
 void processor::start(const std::size_t threadCount) {
@@ -30,29 +32,29 @@ void processor::start(const std::size_t threadCount) {
 	lock_t lock(stateChangeMutex);
 	
 	if(!isRunning) {
+		// Each thread gets its own connection to every simulator
+		while(simulatorBalancer.worker_count() < threadCount) {
+			simulatorBalancer.add_worker(logger);
+		}
+		while(simulatorBalancer.worker_count() > threadCount) {
+			simulatorBalancer.pop_worker();
+		}
+		
+		// Create a system on every simulator before the worker threads take over
+		// their clients
+		/** \todo (move this elsewhere) */
+		for(std::size_t i = 0; i < simulatorBalancer.endpoint_count(); i++) {
+			simulator::create_system(simulatorBalancer.worker(0).get(i), "chp_state");
+		}
+		
 		for(std::size_t i = 0; i < threadCount; i++) {
-			// Each thread gets its own simulator connection
-			// If we don't have enough clients, we add one. If we have too many, we remove
-			// one. On the last iteration, we have exactly the number of clients we need.
-			if(simulatorClientPool.size() < threadCount) {
-				simulatorClientPool.add(simulatorEndpoint, logger);
-			} else if(simulatorClientPool.size() > threadCount) {
-				simulatorClientPool.pop();
-			}
-			
-			workerThreads[i] = std::thread(&processor::work,
-					this,
-					i,
-					std::ref(simulatorClientPool.get(i)));
+			workerThreads[i] = std::thread(&processor::work, this, i);
 		}
 		
 		// Update our internal state
+		this->threadCount = threadCount;
 		isRunning = true;
 	}
-	
-	// Create a system
-	/** \todo (move this elsewhere) */
-	simulator::create_system(simulatorClientPool.get(0), "chp_state");
 }
 
 void processor::stop() {
@@ -71,20 +73,93 @@ void processor::stop() {
 	}
 }
 
-void processor::work(const std::size_t id, ::simulator::client& client) {
-	UNUSED(id);
+void processor::admit(interpreted_request&& item) {
+	assert(item.action() == ::action::tx);
+	
+	const ::model::node::id_t node = item.from().id();
+	
+	if(nodeCapacity != 0) {
+		lock_t lock(admissionMutex);
+		
+		std::size_t& queued = nodeQueued[node];
+		if(queued >= nodeCapacity) {
+			item.detach();
+			throw overload_error(retryAfter);
+		}
+		queued++;
+	}
+	
+	if(UNLIKELY(!incomingBuffer.try_push(std::move(item)))) {
+		if(nodeCapacity != 0) {
+			release_admission(node);
+		}
+		
+		item.detach();
+		throw overload_error(retryAfter);
+	}
+}
+
+void processor::admit_all(std::vector<interpreted_request>& items) {
+	if(nodeCapacity != 0) {
+		lock_t lock(admissionMutex);
+		
+		// Either every request takes its share or none does
+		for(std::size_t i = 0; i < items.size(); i++) {
+			std::size_t& queued = nodeQueued[items[i].from().id()];
+			if(queued >= nodeCapacity) {
+				for(std::size_t j = 0; j < i; j++) {
+					nodeQueued[items[j].from().id()]--;
+				}
+				throw overload_error(retryAfter);
+			}
+			queued++;
+		}
+	}
+	
+	// The requests are left alone if they do not fit, so their shares can be taken back
+	if(UNLIKELY(!incomingBuffer.try_push_all(items))) {
+		if(nodeCapacity != 0) {
+			for(auto& item : items) {
+				release_admission(item.from().id());
+			}
+		}
+		
+		throw overload_error(retryAfter);
+	}
+}
+
+void processor::log_expired(const interpreted_request& item) {
+	static const char node[] = "{\"node\":";
+	static const char expired[] = ",\"expired\":";
+	
+	// Room for two numbers of up to 20 digits, so no allocation is needed
+	char json[sizeof(node) + sizeof(expired) + 2*20];
+	char* p = json;
+	memcpy(p, node, sizeof(node) - 1);
+	p = ::rapidjson::internal::u64toa(item.from().id(), p + sizeof(node) - 1);
+	memcpy(p, expired, sizeof(expired) - 1);
+	p = ::rapidjson::internal::u64toa(++expiredCount, p + sizeof(expired) - 1);
+	*p++ = '}';
 	
+	logger->put(::action::tx_expired, json, p - json);
+}
+
+void processor::work(const std::size_t id) {
 	incoming_buffer().set_push_wait_threshold(1);
 	std::size_t emptyCount = 0;
 	std::size_t emptyCountThreshold = 2;
 	
 	while(!doExit) {
-		if(incomingBuffer.push_wait(PROCESSOR_WORK_WAIT) ||
-				++emptyCount >= emptyCountThreshold) {
+		// Only a parked wait can miss a push, see buffer::push_wait()
+		if(incomingBuffer.push_wait(idle, PROCESSOR_WORK_WAIT) ||
+				(idle.mode() == idle_mode::park && ++emptyCount >= emptyCountThreshold)) {
 			emptyCount = 0;
 			
 			while(incomingBuffer.size() != 0) {
 				auto item(incomingBuffer.pop());
+				if(nodeCapacity != 0 && item.action() == ::action::tx) {
+					release_admission(item.from().id());
+				}
 				
 				switch(item.action()) {
 				 case ::action::configure_node:
@@ -140,6 +215,14 @@ void processor::work(const std::size_t id, ::simulator::client& client) {
 				 }
 				 case ::action::tx:
 				 {
+					// Nobody waits for the result of a stale transmission any more, so
+					// it is dropped before it costs a simulation
+					if(UNLIKELY(expired(item))) {
+						log_expired(item);
+						item.complete(err_msg::_expired);
+						continue;
+					}
+					
 					// Traverse the network
 					::model::node* incoming = &item.from();
 					::model::node* endpointNode = 0;
@@ -186,26 +269,42 @@ void processor::work(const std::size_t id, ::simulator::client& client) {
 					// If the endpoint node has no configured detector, we drop the transmission
 					if(receivingClient->get_detector().simulation_unit().description() == 0) {
 						std::cerr << "no detector";
+						item.complete("no detector");
+						continue;
+					}
+					
+					// Routing is valid, so a client waiting for it need not wait for the
+					// simulation
+					item.complete(nullptr);
+					
+					// Nobody would see the result
+					if(skipUnobserved && !rxSubscriptions.observed(receivingClient->id())) {
 						continue;
 					}
 					
-					// Our simulation circuit description
+					// Our simulation circuit description is the sender circuit followed by the
+					// detector, which are sent as fragments rather than concatenated here
 					/** \todo: this has some problems, especially if incoming and outgoing circuit
 					 * is of different dialect or line delimiter
 					 */
-					std::string circuit = std::string(item.parameter<const char*>(1)) + std::string("\n") +
-							std::string(receivingClient->get_detector().simulation_unit().description());
+					const auto& detector = receivingClient->get_detector().simulation_unit();
 					
-					auto measurement(simulator::compute_result(client,
-							1,
-							simulator::unit(receivingClient->get_detector().simulation_unit().dialect(),
-							circuit.c_str(),
-							receivingClient->get_detector().simulation_unit().line_delimiter())));
-					
-					char* ptr;
-					std::uint_fast64_t result = strtol(measurement.c_str(), &ptr, 2);
+					std::uint_fast64_t result;
+					try {
+						result = simulatorBalancer.call(id, [&] (::simulator::client& client) {
+							return simulator::compute_result(client,
+									1,
+									detector.dialect(),
+									{item.parameter<const char*>(1), "\n", detector.description()},
+									detector.line_delimiter());
+						});
+					} catch(const ::simulator::network_error& e) {
+						// Every simulator failed, so we drop the transmission
+						std::cerr << e.what() << std::endl;
+						continue;
+					}
 					
-					outgoingBuffer.push(::push_message(receivingClient->id(), result, item.tx_timestamp()));
+					push_outgoing(::push_message(receivingClient->id(), result, item.tx_timestamp()));
 					break;
 				 }
 				 default:
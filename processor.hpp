@@ -7,11 +7,20 @@
 #include "model/network.hpp"
 #include "model/state.hpp"
 #include "simulator/adapter.hpp"
-#include "simulator/client_pool.hpp"
+#include "simulator/balancer.hpp"
 #include "buffer.hpp"
+#include "subscriptions.hpp"
 #include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <iostream>
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+#include <string>
 #include <thread>
+#include <unordered_map>
+#include <vector>
 #include <zmq.hpp>
 
 /**
@@ -19,9 +28,49 @@
  */
 #define PROCESSOR_MAX_THREADS 4
 
+/**
+ * \brief The maximum number of outgoing buffers results are sharded between.
+ */
+#define PROCESSOR_MAX_OUTGOING_SHARDS 8
+
 
 #define PROCESSOR_WORK_WAIT 15 // milliseconds
 
+/**
+ * \brief The default time a client turned away because the incoming buffer is full is
+ * asked to wait before trying again.
+ * 
+ * \note Milliseconds.
+ */
+#define PROCESSOR_RETRY_AFTER 10
+
+/**
+ * \brief Thrown when a request is turned away because the incoming buffer, or the share
+ * of it that its node may take, is full.
+ */
+class overload_error : public std::runtime_error {
+ public:
+	/**
+	 * \brief Constructor takes the time the client should wait before trying again.
+	 */
+	explicit overload_error(const std::uint32_t retryAfter)
+			: std::runtime_error(err_msg::_svrbusy),
+			_retryAfter(retryAfter) {
+	}
+	
+	/**
+	 * \brief Return the time the client should wait before trying again.
+	 * 
+	 * \note Milliseconds.
+	 */
+	inline std::uint32_t retry_after() const {
+		return _retryAfter;
+	}
+
+ private:
+	std::uint32_t _retryAfter;
+};
+
 /**
  * \brief Processes incoming requests and generates outgoing replies.
  */
@@ -31,10 +80,11 @@ class processor {
  
  public:
 	/**
-	 * \brief Constructor.
+	 * \brief Constructor takes the endpoints of every simulator work is balanced
+	 * between.
 	 */
 	processor(::diagnostics::logger* const logger,
-			const char* const simulatorEndpoint,
+			const std::vector<std::string>& simulatorEndpoints,
 			model::state& state,
 			::zmq::context_t& context);
 	
@@ -85,21 +135,93 @@ class processor {
 	 * 
 	 * This validates the to and from fields. 
 	 * 
-	 * If a client is not found then an exception is thrown.
+	 * If a client is not found then an exception is thrown, and message and done are
+	 * left alone. Otherwise the request takes the message, which the strings should
+	 * point into, and done is completed once the routing of a transmission has been
+	 * checked, see interpreted_request.
 	 */
 	interpreted_request preprocess(const action type,
 			const ::model::node::id_t from,
+			::zmq::message_t&& message,
 			const char* const component,
 			const char* const dialect,
 			const char* const circuit,
-			const char lineDelimiter) {
+			const char lineDelimiter,
+			::completion* const done = nullptr) {
 		return interpreted_request(type,
 				st.network().find_node(from),
+				std::move(message),
 				component,
 				dialect,
 				circuit,
 				lineDelimiter,
-				st.sim_time().now());
+				st.sim_time().now(),
+				done);
+	}
+	
+	/**
+	 * \brief Set the number of requests the incoming buffer holds at most, and the
+	 * number of those that may come from any single node, which are 0 for no limit.
+	 * 
+	 * A transmission that does not fit is turned away by admit() with an
+	 * overload_error that asks the client to try again after retryAfter milliseconds.
+	 * Configuration requests are pushed into the incoming buffer directly and are
+	 * neither limited nor counted.
+	 * 
+	 * \warning Must be called before any request is admitted.
+	 */
+	inline void set_admission(const std::size_t capacity,
+			const std::size_t nodeCapacity,
+			const std::uint32_t retryAfter) {
+		incomingBuffer.set_capacity(capacity);
+		this->nodeCapacity = nodeCapacity;
+		this->retryAfter = retryAfter;
+	}
+	
+	/**
+	 * \brief Push a transmission into the incoming buffer if there is room for it.
+	 * 
+	 * Otherwise an overload_error is thrown and whoever waits for the request is not
+	 * completed, since the caller owes them a reply.
+	 * 
+	 * \note Threadsafe
+	 */
+	void admit(interpreted_request&& item);
+	
+	/**
+	 * \brief Push every transmission of a vector into the incoming buffer and clear it
+	 * if there is room for all of them.
+	 * 
+	 * Otherwise an overload_error is thrown and the requests are left alone.
+	 * 
+	 * \note Threadsafe
+	 */
+	void admit_all(std::vector<interpreted_request>& items);
+	
+	/**
+	 * \brief Return the wall deadline of a request that may wait at most budget
+	 * milliseconds from now, see interpreted_request::set_deadline().
+	 * 
+	 * A budget too large to be expressed never runs out, rather than wrapping around
+	 * to a deadline in the past.
+	 */
+	static inline std::uint_fast64_t wall_deadline(const std::uint_fast64_t budget) {
+		const std::uint_fast64_t now = steady_now();
+		if(UNLIKELY(budget > (std::numeric_limits<std::uint_fast64_t>::max() - now)/1000000)) {
+			return std::numeric_limits<std::uint_fast64_t>::max();
+		}
+		
+		return now + budget*1000000;
+	}
+	
+	/**
+	 * \brief Return the number of transmissions dropped because they went stale while
+	 * queued.
+	 * 
+	 * \note Threadsafe
+	 */
+	inline std::uint_fast64_t expired_count() const {
+		return expiredCount;
 	}
 	
 	/**
@@ -110,10 +232,82 @@ class processor {
 	}
 	
 	/**
-	 * \brief Return a reference to the outgoing buffer.
+	 * \brief Return a reference to an outgoing buffer.
+	 */
+	inline outgoingBuffer_t& outgoing_buffer(const std::size_t shard) {
+		assert(shard < outgoingShardCount);
+		
+		return outgoingBuffers[shard];
+	}
+	
+	/**
+	 * \brief Return the number of outgoing buffers.
+	 */
+	inline std::size_t outgoing_shard_count() const {
+		return outgoingShardCount;
+	}
+	
+	/**
+	 * \brief Set the number of outgoing buffers results are sharded between by topic,
+	 * so each topic keeps its order.
+	 * 
+	 * \warning Must be called before start(), with the number of rx workers the
+	 * server listens with.
+	 */
+	inline void set_outgoing_shards(const std::size_t count) {
+		if(UNLIKELY(count == 0 || count > PROCESSOR_MAX_OUTGOING_SHARDS)) {
+			throw std::invalid_argument(err_msg::_arybnds);
+		}
+		
+		outgoingShardCount = count;
+	}
+	
+	/**
+	 * \brief Push a result into the outgoing buffer of its topic.
+	 * 
+	 * \note Threadsafe
+	 */
+	inline void push_outgoing(push_message&& message) {
+		outgoingBuffers[message.topic() % outgoingShardCount].push(std::move(message));
+	}
+	
+	/**
+	 * \brief Return a reference to the balancer of simulator calls.
+	 * 
+	 * Settings that apply to new workers must be made before start().
+	 */
+	inline ::simulator::balancer& simulator_balancer() {
+		return simulatorBalancer;
+	}
+	
+	/**
+	 * \brief Return a reference to the rx topics that have a live subscription. The
+	 * server keeps this up to date.
+	 */
+	inline ::subscriptions& rx_subscriptions() {
+		return rxSubscriptions;
+	}
+	
+	/**
+	 * \brief Set whether a transmission to a receiver whose rx topic nobody subscribes
+	 * to is dropped once its routing has been checked, instead of being simulated.
+	 * 
+	 * Computing a result has no side effects, so nobody can tell the difference.
+	 * 
+	 * \warning Must be called before start().
+	 */
+	inline void set_skip_unobserved(const bool skip) {
+		skipUnobserved = skip;
+	}
+	
+	/**
+	 * \brief Set how the processing threads wait for requests, which is to park by
+	 * default.
+	 * 
+	 * \warning Must be called before start().
 	 */
-	inline outgoingBuffer_t& outgoing_buffer() {
-		return outgoingBuffer;
+	inline void set_idle(const idle_strategy& idle) {
+		this->idle = idle;
 	}
 
  private:
@@ -133,20 +327,64 @@ class processor {
 	incomingBuffer_t incomingBuffer;
 	
 	/**
-	 * \brief The buffer containing items that have already been processed. The server
-	 * empties this.
+	 * \brief The buffers containing items that have already been processed, sharded by
+	 * topic. The server empties these.
+	 */
+	outgoingBuffer_t outgoingBuffers[PROCESSOR_MAX_OUTGOING_SHARDS];
+	
+	/**
+	 * \brief The number of outgoing buffers in use.
+	 */
+	std::atomic<std::size_t> outgoingShardCount;
+	
+	/**
+	 * \brief Clients connected to each simulator, balanced between for every call.
 	 */
-	outgoingBuffer_t outgoingBuffer;
+	::simulator::balancer simulatorBalancer;
 	
 	/**
-	 * \brief The endpoint of our simulator.
+	 * \brief The rx topics that have a live subscription.
 	 */
-	char* simulatorEndpoint;
+	::subscriptions rxSubscriptions;
 	
 	/**
-	 * \brief A pool of clients connected to the simulator.
+	 * \brief Whether unobserved transmissions are dropped, see set_skip_unobserved().
 	 */
-	::simulator::client_pool simulatorClientPool;
+	bool skipUnobserved;
+	
+	/**
+	 * \brief How the processing threads wait for requests.
+	 */
+	idle_strategy idle;
+	
+	/**
+	 * \brief The number of requests of a single node the incoming buffer holds at
+	 * most, or 0.
+	 */
+	std::size_t nodeCapacity;
+	
+	/**
+	 * \brief The time a client that is turned away is asked to wait.
+	 * 
+	 * \note Milliseconds.
+	 */
+	std::uint32_t retryAfter;
+	
+	/**
+	 * \brief The number of transmissions dropped because they went stale.
+	 */
+	std::atomic<std::uint_fast64_t> expiredCount;
+	
+	/**
+	 * \brief Mutex to protect the queued requests of each node.
+	 */
+	std::mutex admissionMutex;
+	
+	/**
+	 * \brief The number of transmissions of each node within the incoming buffer,
+	 * which is only kept with a node capacity.
+	 */
+	std::unordered_map<::model::node::id_t, std::size_t> nodeQueued;
 	
 	/**
 	 * \brief The worker threads that run the processing function.
@@ -174,10 +412,45 @@ class processor {
 	 */
 	std::atomic_bool doExit;
 	
+	/**
+	 * \brief Take back the share of the incoming buffer of a node, once one of its
+	 * transmissions has been popped.
+	 */
+	inline void release_admission(const ::model::node::id_t node) {
+		lock_t lock(admissionMutex);
+		
+		nodeQueued[node]--;
+	}
+	
+	/**
+	 * \brief Return the time of the steady clock.
+	 * 
+	 * \note Nanoseconds.
+	 */
+	static inline std::uint_fast64_t steady_now() {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+	
+	/**
+	 * \brief Return whether a request has gone stale. The clocks are only read for a
+	 * request with a deadline.
+	 */
+	inline bool expired(const interpreted_request& item) {
+		return (item.wall_deadline() != 0 && steady_now() >= item.wall_deadline()) ||
+				(item.sim_deadline() != 0 && st.sim_time().now() >= item.sim_deadline());
+	}
+	
+	/**
+	 * \brief Count a transmission dropped because it went stale and log its node
+	 * along with the number dropped so far.
+	 */
+	void log_expired(const interpreted_request& item);
+	
 	/**
 	 * \brief The work function that each worker thread executes.
 	 */
-	void work(const std::size_t id, ::simulator::client& client);
+	void work(const std::size_t id);
 };
 
 #endif
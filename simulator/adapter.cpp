@@ -5,8 +5,8 @@ namespace simulator {
 			const std::size_t count,
 			const std::int_fast64_t lower,
 			const std::int_fast64_t upper) {
-		// Our conn.call() takes ownership of the request
-		response rspns(conn.call((new request("get_uniform_integer"))
+		// The request is owned by conn and reused by every call
+		const response& rspns(conn.call(conn.prepare(method::get_uniform_integer)
 				->add<std::size_t>(count)
 				->add<std::int_fast64_t>(lower)
 				->add<std::int_fast64_t>(upper)));
@@ -22,8 +22,8 @@ namespace simulator {
 			const std::size_t count,
 			const double lower,
 			const double upper) {
-		// Our conn.call() takes ownership of the request
-		response rspns(conn.call((new request("get_uniform_real"))
+		// The request is owned by conn and reused by every call
+		const response& rspns(conn.call(conn.prepare(method::get_uniform_real)
 				->add<std::size_t>(count)
 				->add<double>(lower)
 				->add<double>(upper)));
@@ -38,8 +38,8 @@ namespace simulator {
 	std::vector<std::uint_fast64_t> get_weighted_integer(client& conn,
 			const std::uint_fast64_t count,
 			std::vector<double>&& weights) {
-		// Our conn.call() takes ownership of the request
-		response rspns(conn.call((new request("get_weighted_integer"))
+		// The request is owned by conn and reused by every call
+		const response& rspns(conn.call(conn.prepare(method::get_weighted_integer)
 				->add<std::size_t>(count)
 				->add<std::vector<double>&&>(std::move(weights))));
 		
@@ -58,8 +58,8 @@ namespace simulator {
 		}
 		#endif
 		
-		// Our conn.call() takes ownership of the request
-		response rspns(conn.call((new request("create_system"))
+		// The request is owned by conn and reused by every call
+		const response& rspns(conn.call(conn.prepare(method::create_system)
 				->add<const char*, false>(stateType)));
 		
 		if(UNLIKELY(rspns.error())) {
@@ -71,8 +71,8 @@ namespace simulator {
 	
 	bool delete_system(client& conn,
 			const std::uint_fast64_t systemId) {
-		// Our conn.call() takes ownership of the request
-		response rspns(conn.call((new request("delete_system"))
+		// The request is owned by conn and reused by every call
+		const response& rspns(conn.call(conn.prepare(method::delete_system)
 				->add<std::uint_fast64_t>(systemId)));
 		
 		if(UNLIKELY(rspns.error())) {
@@ -91,8 +91,8 @@ namespace simulator {
 		}
 		#endif
 		
-		// Our conn.call() takes ownership of the request
-		response rspns(conn.call((new request("create_state"))
+		// The request is owned by conn and reused by every call
+		const response& rspns(conn.call(conn.prepare(method::create_state)
 				->add<std::uint_fast64_t>(systemId)
 				->add<const char*, false>(simUnit.dialect())
 				->add<const char*, false>(simUnit.description())
@@ -108,8 +108,8 @@ namespace simulator {
 	bool delete_state(client& conn,
 			const std::uint_fast64_t systemId,
 			const std::uint_fast64_t stateId) {
-		// Our conn.call() takes ownership of the request
-		response rspns(conn.call((new request("delete_state"))
+		// The request is owned by conn and reused by every call
+		const response& rspns(conn.call(conn.prepare(method::delete_state)
 				->add<std::uint_fast64_t>(systemId)
 				->add<std::uint_fast64_t>(stateId)));
 		
@@ -130,8 +130,8 @@ namespace simulator {
 		}
 		#endif
 		
-		// Our conn.call() takes ownership of the request
-		response rspns(conn.call((new request("modify_state"))
+		// The request is owned by conn and reused by every call
+		const response& rspns(conn.call(conn.prepare(method::modify_state)
 				->add<std::uint_fast64_t>(systemId)
 				->add<std::uint_fast64_t>(stateId)
 				->add<const char*, false>(simUnit.dialect())
@@ -145,7 +145,7 @@ namespace simulator {
 		return rspns.result<bool>();
 	}
 	
-	std::string measure_state(client& conn,
+	std::uint_fast64_t measure_state(client& conn,
 			const std::uint_fast64_t systemId,
 			const std::uint_fast64_t stateId,
 			unit&& simUnit) {
@@ -155,8 +155,8 @@ namespace simulator {
 		}
 		#endif
 		
-		// Our conn.call() takes ownership of the request
-		response rspns(conn.call((new request("measure_state"))
+		// The request is owned by conn and reused by every call
+		const response& rspns(conn.call(conn.prepare(method::measure_state)
 				->add<std::uint_fast64_t>(systemId)
 				->add<std::uint_fast64_t>(stateId)
 				->add<const char*, false>(simUnit.dialect())
@@ -167,10 +167,10 @@ namespace simulator {
 			throw std::runtime_error("Simulator returned error");
 		}
 		
-		return rspns.result<const char*>();
+		return rspns.result_bits();
 	}
 	
-	std::string compute_result(client& conn,
+	std::uint_fast64_t compute_result(client& conn,
 			const std::uint_fast64_t systemId,
 			unit&& simUnit) {
 		#ifdef THROW
@@ -179,8 +179,8 @@ namespace simulator {
 		}
 		#endif
 		
-		// Our conn.call() takes ownership of the request
-		response rspns(conn.call((new request("compute_result"))
+		// The request is owned by conn and reused by every call
+		const response& rspns(conn.call(conn.prepare(method::compute_result)
 				->add<std::uint_fast64_t>(systemId)
 				->add<const char*, false>(simUnit.dialect())
 				->add<const char*, false>(simUnit.description())
@@ -190,6 +190,31 @@ namespace simulator {
 			throw std::runtime_error("Simulator returned error");
 		}
 		
-		return rspns.result<const char*>();
+		return rspns.result_bits();
+	}
+	
+	std::uint_fast64_t compute_result(client& conn,
+			const std::uint_fast64_t systemId,
+			const char* const dialect,
+			fragments description,
+			const char lineDelimiter) {
+		#ifdef THROW
+		if(UNLIKELY(dialect == nullptr)) {
+			throw std::invalid_argument(err_msg::_nllpntr);
+		}
+		#endif
+		
+		// The request is owned by conn and reused by every call
+		const response& rspns(conn.call(conn.prepare(method::compute_result)
+				->add<std::uint_fast64_t>(systemId)
+				->add<const char*, false>(dialect)
+				->add<fragments>(description)
+				->add<char>(lineDelimiter)));
+		
+		if(UNLIKELY(rspns.error())) {
+			throw std::runtime_error("Simulator returned error");
+		}
+		
+		return rspns.result_bits();
 	}
 }
@@ -68,9 +68,11 @@ namespace simulator {
 			unit&& simUnit);
 	
 	/**
-	 * \brief Measure a state described via a program and return a string of results.
+	 * \brief Measure a state described via a program and return the measured bits.
+	 * 
+	 * The first measurement is the most significant bit.
 	 */
-	std::string measure_state(client& conn,
+	std::uint_fast64_t measure_state(client& conn,
 			const std::uint_fast64_t systemId,
 			const std::uint_fast64_t stateId,
 			unit&& simUnit);
@@ -78,10 +80,26 @@ namespace simulator {
 	/**
 	 * \brief Compute the result of a circuit without state, i.e. the state is never
 	 * stored within the system.
+	 * 
+	 * The measured bits are returned with the first measurement as the most
+	 * significant bit.
 	 */
-	std::string compute_result(client& conn,
+	std::uint_fast64_t compute_result(client& conn,
 			const std::uint_fast64_t systemId,
 			unit&& simUnit);
+	
+	/**
+	 * \brief Compute the result of a circuit without state, whose description is given
+	 * as fragments that are sent as if they had been concatenated.
+	 * 
+	 * The measured bits are returned with the first measurement as the most
+	 * significant bit.
+	 */
+	std::uint_fast64_t compute_result(client& conn,
+			const std::uint_fast64_t systemId,
+			const char* const dialect,
+			fragments description,
+			const char lineDelimiter);
 }
 
 #endif
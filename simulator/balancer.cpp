@@ -0,0 +1,228 @@
+#include "balancer.hpp"
+
+namespace simulator {
+	balancer::balancer(::zmq::context_t& context)
+			: context(context),
+			endpointCount(0),
+			workers{0},
+			workerCount(0),
+			cursor(0),
+			deadline(SIMULATOR_CLIENT_POOL_RECVTO),
+			hedging(false),
+			binary(false),
+			hedgeDelay(0),
+			histogramSamples(0) {
+		for(auto& bucket : histogram) {
+			bucket = 0;
+		}
+	}
+	
+	balancer::~balancer() {
+		while(workerCount > 0) {
+			pop_worker();
+		}
+		
+		for(std::size_t i = 0; i < endpointCount; i++) {
+			delete[] targets[i].endpoint;
+		}
+	}
+	
+	void balancer::add_endpoint(const char* const endpoint) {
+		if(UNLIKELY(endpointCount >= SIMULATOR_BALANCER_MAX_ENDPOINTS)) {
+			throw std::invalid_argument(err_msg::_arybnds);
+		}
+		
+		auto& tgt = targets[endpointCount];
+		tgt.endpoint = new char[strlen(endpoint) + 1];
+		strcpy(tgt.endpoint, endpoint);
+		tgt.outstanding = 0;
+		tgt.failures = 0;
+		tgt.ejectedUntil = 0;
+		tgt.latency = 0;
+		tgt.negotiated = false;
+		tgt.enc = encoding::json;
+		
+		endpointCount++;
+	}
+	
+	void balancer::add_worker(::diagnostics::logger* const logger) {
+		if(UNLIKELY(workerCount >= SIMULATOR_BALANCER_MAX_WORKERS)) {
+			throw std::invalid_argument(err_msg::_arybnds);
+		}
+		
+		auto pool = new client_pool(context);
+		for(std::size_t i = 0; i < endpointCount; i++) {
+			pool->add(targets[i].endpoint, logger, SIMULATOR_CLIENT_POOL_SENDTO, deadline);
+			
+			auto& tgt = targets[i];
+			if(binary && !tgt.negotiated) {
+				tgt.enc = (pool->get(i).negotiate() ? encoding::binary : encoding::json);
+				tgt.negotiated = true;
+			}
+			pool->get(i).set_encoding(tgt.enc);
+		}
+		
+		workers[workerCount++] = pool;
+	}
+	
+	void balancer::pop_worker() {
+		if(workerCount > 0) {
+			delete workers[workerCount-1];
+			workers[--workerCount] = 0;
+		}
+	}
+	
+	std::size_t balancer::select(const std::uint_fast32_t tried,
+			const bool allowEjected,
+			const encoding* const enc) {
+		const std::uint_fast64_t time = now();
+		const std::size_t start = cursor++;
+		
+		std::size_t best = endpointCount;
+		std::size_t fallback = endpointCount;
+		
+		for(std::size_t i = 0; i < endpointCount; i++) {
+			const std::size_t idx = (start + i) % endpointCount;
+			if(tried & (1 << idx)) {
+				continue;
+			}
+			
+			auto& tgt = targets[idx];
+			if(enc != 0 && tgt.enc != *enc) {
+				continue;
+			}
+			
+			const std::uint_fast64_t ejectedUntil = tgt.ejectedUntil;
+			if(ejectedUntil > time) {
+				if(fallback == endpointCount ||
+						ejectedUntil < targets[fallback].ejectedUntil) {
+					fallback = idx;
+				}
+			} else if(best == endpointCount ||
+					tgt.outstanding < targets[best].outstanding ||
+					(tgt.outstanding == targets[best].outstanding &&
+					tgt.latency < targets[best].latency)) {
+				best = idx;
+			}
+		}
+		
+		if(best == endpointCount && allowEjected) {
+			// Every endpoint left is ejected, so try the one that recovers first rather
+			// than failing outright
+			best = fallback;
+		}
+		
+		return best;
+	}
+	
+	void balancer::settle(const client& conn,
+			const std::size_t idx,
+			const std::size_t hedgeIdx,
+			const bool success,
+			const std::uint_fast64_t elapsed,
+			const std::uint_fast64_t delay) {
+		if(hedgeIdx != endpointCount) {
+			targets[hedgeIdx].outstanding--;
+			
+			// A hedge that was sent but lost the race tells us nothing about its endpoint
+			if(conn.hedge_won() || (conn.hedge_fired() && !success)) {
+				record(hedgeIdx, success, elapsed - delay);
+			}
+		}
+		
+		if(conn.hedge_won()) {
+			targets[idx].outstanding--;
+			charge(idx, elapsed);
+		} else {
+			release(idx, success, elapsed);
+		}
+	}
+	
+	void balancer::record(const std::size_t idx,
+			const bool success,
+			const std::uint_fast64_t elapsed) {
+		auto& tgt = targets[idx];
+		
+		if(!success) {
+			const std::uint_fast32_t failures = ++tgt.failures;
+			if(failures >= SIMULATOR_BALANCER_EJECT_FAILURES) {
+				eject(tgt, failures);
+			}
+			return;
+		}
+		
+		tgt.failures = 0;
+		tgt.ejectedUntil = 0;
+		
+		sample(elapsed);
+		charge(idx, elapsed);
+	}
+	
+	void balancer::charge(const std::size_t idx, const std::uint_fast64_t elapsed) {
+		auto& tgt = targets[idx];
+		
+		// Moving average with a weight of 1/8 for the newest sample
+		std::uint_fast64_t latency = tgt.latency;
+		latency = (latency == 0 ? elapsed : latency - latency/8 + elapsed/8);
+		tgt.latency = latency;
+		
+		if(latency < SIMULATOR_BALANCER_SLOW_FLOOR) {
+			return;
+		}
+		
+		// Compare against the fastest of the other healthy endpoints. If there are none,
+		// this endpoint is all we have and ejecting it would not help.
+		const std::uint_fast64_t time = now();
+		std::uint_fast64_t bestLatency = 0;
+		for(std::size_t i = 0; i < endpointCount; i++) {
+			const std::uint_fast64_t other = targets[i].latency;
+			if(i != idx && other != 0 && targets[i].ejectedUntil <= time &&
+					(bestLatency == 0 || other < bestLatency)) {
+				bestLatency = other;
+			}
+		}
+		
+		if(bestLatency != 0 && latency > bestLatency * SIMULATOR_BALANCER_SLOW_FACTOR) {
+			eject(tgt, SIMULATOR_BALANCER_EJECT_FAILURES);
+		}
+	}
+	
+	void balancer::eject(target& tgt, const std::uint_fast32_t failures) {
+		std::uint_fast32_t shift = failures - SIMULATOR_BALANCER_EJECT_FAILURES;
+		if(shift > 5) {
+			shift = 5;
+		}
+		
+		tgt.ejectedUntil = now() + ((std::uint_fast64_t)SIMULATOR_BALANCER_EJECT_TIME*1000 << shift);
+		// Forget the old latency so the endpoint is judged afresh when it is retried
+		tgt.latency = 0;
+	}
+	
+	void balancer::sample(const std::uint_fast64_t elapsed) {
+		histogram[histogram_bucket(elapsed)]++;
+		
+		// Only the thread completing a window recalculates, the others carry on
+		if(++histogramSamples != SIMULATOR_BALANCER_HEDGE_WINDOW) {
+			return;
+		}
+		
+		std::uint_fast32_t counts[SIMULATOR_BALANCER_HISTOGRAM_SIZE];
+		std::uint_fast64_t total = 0;
+		for(std::size_t i = 0; i < SIMULATOR_BALANCER_HISTOGRAM_SIZE; i++) {
+			// Halve every bucket so old samples fade out
+			counts[i] = histogram[i];
+			histogram[i] -= counts[i]/2;
+			total += counts[i];
+		}
+		
+		const std::uint_fast64_t target = total*SIMULATOR_BALANCER_HEDGE_PERCENTILE/100;
+		std::uint_fast64_t sum = 0;
+		std::size_t idx = 0;
+		while(idx < SIMULATOR_BALANCER_HISTOGRAM_SIZE-1 && (sum += counts[idx]) < target) {
+			idx++;
+		}
+		
+		hedgeDelay = histogram_ceiling(idx);
+		histogramSamples = 0;
+	}
+}
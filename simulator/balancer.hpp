@@ -0,0 +1,466 @@
+#ifndef _SIMULATOR_BALANCER_HPP
+#define _SIMULATOR_BALANCER_HPP
+
+#include <common.hpp>
+#include "client.hpp"
+#include "client_pool.hpp"
+#include <atomic>
+#include <chrono>
+#include <utility>
+#include <zmq.hpp>
+
+/**
+ * \brief The maximum number of simulator endpoints we balance between.
+ */
+#define SIMULATOR_BALANCER_MAX_ENDPOINTS SIMULATOR_CLIENT_POOL_MAX_SIZE
+
+/**
+ * \brief The maximum number of workers, each of which gets its own client per endpoint.
+ */
+#define SIMULATOR_BALANCER_MAX_WORKERS 16
+
+/**
+ * \brief The number of consecutive network failures before an endpoint is ejected.
+ */
+#define SIMULATOR_BALANCER_EJECT_FAILURES 3
+
+/**
+ * \brief The base length of time an endpoint stays ejected before it is retried.
+ * 
+ * Every further failure of a retried endpoint doubles this, up to 32 times the base.
+ * 
+ * \note Milliseconds.
+ */
+#define SIMULATOR_BALANCER_EJECT_TIME 1000
+
+/**
+ * \brief An endpoint whose average latency is this many times the best average latency
+ * of the other healthy endpoints is considered slow and is ejected.
+ */
+#define SIMULATOR_BALANCER_SLOW_FACTOR 8
+
+/**
+ * \brief Average latencies below this are never considered slow, no matter how they
+ * compare to other endpoints.
+ * 
+ * \note Microseconds.
+ */
+#define SIMULATOR_BALANCER_SLOW_FLOOR 2000
+
+/**
+ * \brief The percentile of call latency after which a hedged call is sent to a second
+ * endpoint.
+ */
+#define SIMULATOR_BALANCER_HEDGE_PERCENTILE 99
+
+/**
+ * \brief The number of latency samples between recalculations of the hedge delay.
+ * 
+ * Older samples are halved at every recalculation, so the delay follows the current
+ * latency of the simulators.
+ */
+#define SIMULATOR_BALANCER_HEDGE_WINDOW 1024
+
+/**
+ * \brief The number of buckets of the latency histogram.
+ * 
+ * Each power of two is split into two buckets, which is enough to cover every latency in
+ * microseconds that fits into 32 bits.
+ */
+#define SIMULATOR_BALANCER_HISTOGRAM_SIZE 64
+
+namespace simulator {
+	/**
+	 * \brief Balances calls between several simulator endpoints.
+	 * 
+	 * Every worker gets a client pool containing one client for each endpoint, since
+	 * clients are not threadsafe. The health of each endpoint is shared between all
+	 * workers. A call goes to the healthy endpoint with the least outstanding requests
+	 * and fails over to the next best endpoint on a network error. Endpoints that fail
+	 * repeatedly or are much slower than the rest are ejected for a while and then
+	 * retried.
+	 */
+	class balancer {
+	 public:
+		/**
+		 * \brief Constructor takes the zmq context shared among clients.
+		 */
+		balancer(::zmq::context_t& context);
+		
+		/**
+		 * \brief Copy constructor is disabled.
+		 */
+		balancer(const balancer&) = delete;
+		
+		/**
+		 * \brief Move constructor is disabled.
+		 */
+		balancer(balancer&&) = delete;
+		
+		/**
+		 * \brief Assignment operator is disabled.
+		 */
+		balancer& operator=(const balancer&) = delete;
+		
+		/**
+		 * \brief Move assignment operator is disabled.
+		 */
+		balancer& operator=(balancer&&) = delete;
+		
+		/**
+		 * \brief Destructor deletes the client pools of every worker.
+		 */
+		~balancer();
+		
+		/**
+		 * \brief Add a simulator endpoint.
+		 * 
+		 * Endpoints must all be added before the first worker is added.
+		 */
+		void add_endpoint(const char* const endpoint);
+		
+		/**
+		 * \brief Add a worker with a client connected to every endpoint.
+		 */
+		void add_worker(::diagnostics::logger* const logger = 0);
+		
+		/**
+		 * \brief Remove the last worker added.
+		 * 
+		 * If there are no workers, do nothing.
+		 */
+		void pop_worker();
+		
+		/**
+		 * \brief Set the deadline in milliseconds of every call of workers added from now
+		 * on, or -1 for no deadline.
+		 */
+		inline void set_deadline(const int deadline) {
+			this->deadline = deadline;
+		}
+		
+		/**
+		 * \brief Set whether the binary encoding is negotiated with every endpoint.
+		 * 
+		 * Each endpoint is asked once, when the first worker is added, and endpoints that
+		 * decline are called with JSON. This must be set before the first worker is
+		 * added.
+		 */
+		inline void set_binary(const bool binary) {
+			this->binary = binary;
+		}
+		
+		/**
+		 * \brief Set whether calls that have not been answered after the
+		 * SIMULATOR_BALANCER_HEDGE_PERCENTILE latency are also sent to a second endpoint.
+		 */
+		inline void set_hedging(const bool hedging) {
+			this->hedging = hedging;
+		}
+		
+		/**
+		 * \brief Return the number of endpoints.
+		 */
+		inline std::size_t endpoint_count() const {
+			return endpointCount;
+		}
+		
+		/**
+		 * \brief Return the number of workers.
+		 */
+		inline std::size_t worker_count() const {
+			return workerCount;
+		}
+		
+		/**
+		 * \brief Return the client pool of a worker, indexed by endpoint.
+		 */
+		inline client_pool& worker(const std::size_t workerId) const {
+			#ifdef THROW
+			if(UNLIKELY(workerId >= workerCount)) {
+				throw std::invalid_argument(err_msg::_arybnds);
+			}
+			#endif
+			
+			return *workers[workerId];
+		}
+		
+		/**
+		 * \brief Call func with the client of the best endpoint for a worker and return
+		 * its result.
+		 * 
+		 * If func throws a network_error, the endpoint is marked as failed and func is
+		 * called again with the next best endpoint that has not yet been tried.
+		 * 
+		 * \throws network_error if every endpoint failed.
+		 * 
+		 * \note Threadsafe for distinct workerId.
+		 */
+		template <typename F>
+				auto call(const std::size_t workerId, F&& func)
+				-> decltype(func(std::declval<client&>())) {
+			std::uint_fast32_t tried = 0;
+			
+			for(std::size_t i = 0; i < endpointCount; i++) {
+				const std::size_t idx = acquire(tried);
+				auto& conn = worker(workerId).get(idx);
+				
+				// Hedge to the best other endpoint, once we know what slow means. The hedge
+				// resends the request as it was encoded for this endpoint, so it has to go
+				// to an endpoint that speaks the same encoding.
+				std::size_t hedgeIdx = endpointCount;
+				const std::uint_fast64_t delay = (hedging ? hedgeDelay.load() : 0);
+				if(delay != 0) {
+					hedgeIdx = select(tried | (1 << idx), false, &targets[idx].enc);
+					if(hedgeIdx != endpointCount) {
+						targets[hedgeIdx].outstanding++;
+						conn.set_hedge(&worker(workerId).get(hedgeIdx), delay);
+					}
+				}
+				
+				const std::uint_fast64_t start = now();
+				
+				try {
+					auto result(func(conn));
+					settle(conn, idx, hedgeIdx, true, now() - start, delay);
+					return result;
+				} catch(const network_error&) {
+					// The client has already reconnected whatever socket failed
+					settle(conn, idx, hedgeIdx, false, now() - start, delay);
+					tried |= (1 << idx);
+				} catch(...) {
+					// The simulator answered, so the endpoint itself is healthy
+					settle(conn, idx, hedgeIdx, true, now() - start, delay);
+					throw;
+				}
+			}
+			
+			throw network_error("all simulator endpoints failed");
+		}
+	
+	 private:
+		/**
+		 * \brief The shared health of a single endpoint.
+		 */
+		struct target {
+			/**
+			 * \brief The endpoint of the simulator.
+			 * 
+			 * \note We own this memory.
+			 */
+			char* endpoint;
+			
+			/**
+			 * \brief The number of calls currently in progress.
+			 */
+			std::atomic<std::size_t> outstanding;
+			
+			/**
+			 * \brief The number of consecutive network failures.
+			 */
+			std::atomic<std::uint_fast32_t> failures;
+			
+			/**
+			 * \brief The time the endpoint may be retried if ejected, or 0 if healthy.
+			 * 
+			 * \note Microseconds of now().
+			 */
+			std::atomic<std::uint_fast64_t> ejectedUntil;
+			
+			/**
+			 * \brief The exponentially weighted moving average of the call latency.
+			 * 
+			 * \note Microseconds.
+			 */
+			std::atomic<std::uint_fast64_t> latency;
+			
+			/**
+			 * \brief Whether the binary encoding has been negotiated with the endpoint.
+			 */
+			bool negotiated;
+			
+			/**
+			 * \brief The encoding the endpoint is called with.
+			 */
+			encoding enc;
+		};
+		
+		/**
+		 * \brief The zmq context shared among clients.
+		 */
+		std::reference_wrapper<::zmq::context_t> context;
+		
+		/**
+		 * \brief The health of each endpoint.
+		 */
+		target targets[SIMULATOR_BALANCER_MAX_ENDPOINTS];
+		
+		/**
+		 * \brief The number of endpoints.
+		 */
+		std::size_t endpointCount;
+		
+		/**
+		 * \brief The client pool of each worker.
+		 * 
+		 * \note We own the memory of each pool.
+		 */
+		client_pool* workers[SIMULATOR_BALANCER_MAX_WORKERS];
+		
+		/**
+		 * \brief The number of workers.
+		 */
+		std::size_t workerCount;
+		
+		/**
+		 * \brief The endpoint where the search for the best endpoint starts, so that ties
+		 * are spread evenly.
+		 */
+		std::atomic<std::size_t> cursor;
+		
+		/**
+		 * \brief The deadline in milliseconds given to the clients of new workers.
+		 */
+		int deadline;
+		
+		/**
+		 * \brief Whether slow calls are hedged to a second endpoint.
+		 */
+		bool hedging;
+		
+		/**
+		 * \brief Whether the binary encoding is negotiated with the endpoints.
+		 */
+		bool binary;
+		
+		/**
+		 * \brief How long a call waits before it is hedged, or 0 while there are not yet
+		 * enough samples to tell.
+		 * 
+		 * \note Microseconds.
+		 */
+		std::atomic<std::uint_fast64_t> hedgeDelay;
+		
+		/**
+		 * \brief Histogram of the latency of successful calls over every endpoint.
+		 * 
+		 * See histogram_bucket() for the bucket boundaries.
+		 */
+		std::atomic<std::uint_fast32_t> histogram[SIMULATOR_BALANCER_HISTOGRAM_SIZE];
+		
+		/**
+		 * \brief The number of samples since the hedge delay was last recalculated.
+		 */
+		std::atomic<std::uint_fast32_t> histogramSamples;
+		
+		/**
+		 * \brief Return the current time of a monotonic clock in microseconds.
+		 */
+		static inline std::uint_fast64_t now() {
+			using namespace std::chrono;
+			return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+		}
+		
+		/**
+		 * \brief Return the best endpoint for the next call.
+		 * 
+		 * Endpoints set in the tried bit mask are skipped. If every other endpoint is
+		 * ejected, the one that is retried the soonest is chosen if allowEjected is set,
+		 * otherwise endpoint_count() is returned. If enc is given, only endpoints called
+		 * with that encoding are considered.
+		 */
+		std::size_t select(const std::uint_fast32_t tried,
+				const bool allowEjected,
+				const encoding* const enc = 0);
+		
+		/**
+		 * \brief Choose the endpoint for the next call and count it as outstanding.
+		 */
+		inline std::size_t acquire(const std::uint_fast32_t tried) {
+			const std::size_t idx = select(tried, true);
+			assert(idx != endpointCount);
+			
+			targets[idx].outstanding++;
+			return idx;
+		}
+		
+		/**
+		 * \brief Record the outcome of a call acquired with acquire().
+		 */
+		inline void release(const std::size_t idx,
+				const bool success,
+				const std::uint_fast64_t elapsed) {
+			targets[idx].outstanding--;
+			record(idx, success, elapsed);
+		}
+		
+		/**
+		 * \brief Release the endpoints of a call that may have been hedged to hedgeIdx
+		 * after delay microseconds, and record the outcome of each.
+		 * 
+		 * If the hedge won, the primary endpoint is not credited with the reply of the
+		 * hedge. It is charged the whole elapsed time as its latency instead, without
+		 * clearing its failures.
+		 */
+		void settle(const client& conn,
+				const std::size_t idx,
+				const std::size_t hedgeIdx,
+				const bool success,
+				const std::uint_fast64_t elapsed,
+				const std::uint_fast64_t delay);
+		
+		/**
+		 * \brief Record the outcome of a call to an endpoint.
+		 */
+		void record(const std::size_t idx,
+				const bool success,
+				const std::uint_fast64_t elapsed);
+		
+		/**
+		 * \brief Add a latency to the moving average of an endpoint and eject it if it is
+		 * much slower than the others.
+		 */
+		void charge(const std::size_t idx, const std::uint_fast64_t elapsed);
+		
+		/**
+		 * \brief Add a latency to the histogram and recalculate the hedge delay at the
+		 * end of every window.
+		 */
+		void sample(const std::uint_fast64_t elapsed);
+		
+		/**
+		 * \brief Return the histogram bucket of a latency.
+		 * 
+		 * Bucket 2e holds latencies in [2^e, 1.5*2^e) and bucket 2e+1 holds latencies in
+		 * [1.5*2^e, 2^(e+1)).
+		 */
+		static inline std::size_t histogram_bucket(const std::uint_fast64_t elapsed) {
+			if(elapsed < 2) {
+				return 0;
+			}
+			
+			std::size_t e = 0;
+			while((elapsed >> (e+1)) != 0) {
+				e++;
+			}
+			
+			const std::size_t idx = 2*e + ((elapsed >> (e-1)) & 1);
+			return (idx < SIMULATOR_BALANCER_HISTOGRAM_SIZE ? idx : SIMULATOR_BALANCER_HISTOGRAM_SIZE-1);
+		}
+		
+		/**
+		 * \brief Return the smallest latency above every latency of a bucket.
+		 */
+		static inline std::uint_fast64_t histogram_ceiling(const std::size_t idx) {
+			const std::size_t e = idx/2;
+			return (idx & 1) ? ((std::uint_fast64_t)2 << e) : ((std::uint_fast64_t)3 << e)/2;
+		}
+		
+		/**
+		 * \brief Eject an endpoint until it is retried.
+		 */
+		void eject(target& tgt, const std::uint_fast32_t failures);
+	};
+}
+
+#endif
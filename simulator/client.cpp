@@ -1,4 +1,5 @@
 #include "client.hpp"
+#include <chrono>
 
 namespace simulator {
 	client::client(const char* const endpoint,
@@ -7,8 +8,15 @@ namespace simulator {
 			: logger(logger),
 			context(context),
 			socket(context, ZMQ_REQ),
+			outgoing(new request()),
+			incoming(new response()),
+			enc(encoding::json),
 			sendTimeout(0),
-			receiveTimeout(0) {
+			receiveTimeout(0),
+			hedgePartner(0),
+			hedgeDelay(0),
+			hedgeFired(false),
+			hedgeWon(false) {
 		this->endpoint = new char[strlen(endpoint)+1];
 		strcpy(this->endpoint, endpoint);
 		socket.connect(this->endpoint);
@@ -19,9 +27,18 @@ namespace simulator {
 			logger(old.logger),
 			context(std::move(old.context)),
 			socket(std::move(old.socket)),
+			outgoing(old.outgoing),
+			incoming(old.incoming),
+			enc(old.enc),
 			sendTimeout(old.sendTimeout),
-			receiveTimeout(old.receiveTimeout) {
+			receiveTimeout(old.receiveTimeout),
+			hedgePartner(old.hedgePartner),
+			hedgeDelay(old.hedgeDelay),
+			hedgeFired(old.hedgeFired),
+			hedgeWon(old.hedgeWon) {
 		old.endpoint = 0;
+		old.outgoing = 0;
+		old.incoming = 0;
 	}
 	
 	client& client::operator=(client&& old) {
@@ -30,8 +47,15 @@ namespace simulator {
 		logger = old.logger;
 		context = std::move(old.context);
 		socket = std::move(old.socket);
+		std::swap(outgoing, old.outgoing);
+		std::swap(incoming, old.incoming);
+		enc = old.enc;
 		sendTimeout = old.sendTimeout;
 		receiveTimeout = old.receiveTimeout;
+		hedgePartner = old.hedgePartner;
+		hedgeDelay = old.hedgeDelay;
+		hedgeFired = old.hedgeFired;
+		hedgeWon = old.hedgeWon;
 		
 		return *this;
 	}
@@ -41,6 +65,13 @@ namespace simulator {
 			socket.disconnect(endpoint);
 			delete[] endpoint;
 		}
+		
+		// If zmq still refers to the request, it deletes it once done
+		if(outgoing != 0 && outgoing->reclaim()) {
+			delete outgoing;
+		}
+		
+		delete incoming;
 	}
 	
 	void client::set_timeout(const int sendTimeout, const int receiveTimeout) {
@@ -51,43 +82,168 @@ namespace simulator {
 		socket.setsockopt(ZMQ_RCVTIMEO, &this->receiveTimeout, sizeof(this->receiveTimeout));
 	}
 	
-	response client::call(request* rqst) {
+	void client::reconnect() {
+		// Drop whatever is still queued on the old socket instead of lingering on it
+		const int linger = 0;
+		socket.setsockopt(ZMQ_LINGER, &linger, sizeof(linger));
+		socket.close();
+		
+		socket = ::zmq::socket_t(context, ZMQ_REQ);
+		set_timeout(sendTimeout, receiveTimeout);
+		socket.connect(endpoint);
+	}
+	
+	bool client::negotiate() {
+		// Negotiation itself is always JSON
+		enc = encoding::json;
+		
+		try {
+			const response& rspns(call(prepare(method::negotiate)
+					->add<const char*, false>("binary")
+					->add<std::uint_fast64_t>(SIMULATOR_BINARY_VERSION)));
+			
+			if(!rspns.error() && rspns.result<bool>()) {
+				enc = encoding::binary;
+			}
+		} catch(const network_error&) {
+			// The socket has been reconnected, so we carry on with JSON
+		}
+		
+		return (enc == encoding::binary);
+	}
+	
+	const response& client::call(request* rqst) {
+		return call(rqst, receiveTimeout);
+	}
+	
+	const response& client::call(request* rqst, const int deadline) {
+		using namespace std::chrono;
+		const auto start = steady_clock::now();
+		
+		client* const partner = hedgePartner;
+		hedgePartner = 0;
+		hedgeFired = false;
+		hedgeWon = false;
+		
 		rqst->generate();
 		
-		logger->put(::action::simulator_request,
-				rqst->get_json_encoded(),
-				rqst->get_json_size());
-		
-		bool networkResult = socket.send(::zmq::message_t((void*)rqst->get_json_encoded(),
-				rqst->get_json_size()+1,
-				// This conforms to the requirement imposed by zmq::message_t zero-copy
-				// idiom that passes a pointer to the data along with a hint object.
-				// Because our data is within the hint object, we just deallocate the hint
-				// object, which is our case is a request object. The use of the idiom
-				// ensures we do not copy the data of a request in zmq and rather we tell
-				// zmq the buffer is safe to use until the message is sent. This function
-				// is then called automatically to delete the request object.
-				[](void* data, void* hint) {
-					UNUSED(data);
-					delete static_cast<request*>(hint);
-				},
-				rqst));
-		
-		if(UNLIKELY(!networkResult)) {
-			throw std::runtime_error("network operation failed");
+		// The logger does not want the null terminator of a JSON request
+		log(::action::simulator_request,
+				rqst->get_encoded(),
+				rqst->get_encoded_size() - (rqst->is_binary() ? 0 : 1));
+		
+		// This conforms to the requirement imposed by zmq::message_t zero-copy idiom
+		// that passes a pointer to the data along with a hint object. The request is
+		// reused by the next call, so rather than deleting it, the free function hands
+		// it back to us, see request::release(). The use of the idiom ensures we do not
+		// copy the data of a request in zmq and rather we tell zmq the buffer is safe to
+		// use until the message is sent.
+		rqst->set_sent();
+		::zmq::message_t msg((void*)rqst->get_encoded(),
+				rqst->get_encoded_size(),
+				&request::release,
+				rqst);
+		
+		// A copy of a zero-copy message shares the same reference counted buffer, so
+		// holding on to one for the hedge costs no allocation. The request is deleted
+		// once both messages are done with it.
+		::zmq::message_t hedgeMsg;
+		if(partner != 0) {
+			hedgeMsg.copy(&msg);
+		}
+		
+		if(UNLIKELY(!socket.send(msg))) {
+			reconnect();
+			throw network_error("network operation failed");
 		}
 		
-		::zmq::message_t rspns;
-		networkResult = socket.recv(&rspns);
+		::zmq::pollitem_t items[2] = {
+				{(void*)socket, 0, ZMQ_POLLIN, 0},
+				{0, 0, ZMQ_POLLIN, 0}};
+		std::size_t itemCount = 1;
 		
-		if(UNLIKELY(!networkResult)) {
-			throw std::runtime_error("network operation failed");
+		// Remaining milliseconds until the deadline, or -1 for no deadline
+		auto remaining = [&] () -> long {
+			if(deadline < 0) {
+				return -1;
+			}
+			const long elapsed = duration_cast<milliseconds>(steady_clock::now() - start).count();
+			return (elapsed >= deadline ? 0 : deadline - elapsed);
+		};
+		
+		if(partner != 0) {
+			// Poll has millisecond resolution, so round the hedge delay up
+			long wait = (long)((hedgeDelay + 999) / 1000);
+			if(deadline >= 0 && wait >= deadline) {
+				wait = deadline;
+			}
+			
+			if(::zmq::poll(items, 1, wait) == 0 && remaining() != 0 &&
+					partner->socket.send(hedgeMsg, ZMQ_DONTWAIT)) {
+				hedgeFired = true;
+				items[1].socket = (void*)partner->socket;
+				itemCount = 2;
+			}
+		}
+		
+		if(items[0].revents == 0) {
+			::zmq::poll(items, itemCount, remaining());
+		}
+		
+		client* winner = 0;
+		if(items[0].revents & ZMQ_POLLIN) {
+			winner = this;
+		} else if(itemCount > 1 && (items[1].revents & ZMQ_POLLIN)) {
+			winner = partner;
 		}
 		
-		logger->put(::action::simulator_response,
-				rspns.data(),
+		if(hedgeFired) {
+			// The slower of the two is left waiting for a reply we no longer want
+			if(winner != this) {
+				reconnect();
+			}
+			if(winner != partner) {
+				partner->reconnect();
+			}
+			hedgeWon = (winner == partner);
+		}
+		
+		if(UNLIKELY(winner == 0)) {
+			if(!hedgeFired) {
+				reconnect();
+			}
+			throw network_error("simulator deadline exceeded");
+		}
+		
+		return winner->receive();
+	}
+	
+	const response& client::receive() {
+		// Receiving into the message of the last reply rebuilds it in place
+		::zmq::message_t& rspns = incoming->message();
+		
+		if(UNLIKELY(!socket.recv(&rspns, ZMQ_DONTWAIT))) {
+			// A REQ socket that failed mid-call is stuck waiting for a reply
+			reconnect();
+			throw network_error("network operation failed");
+		}
+		
+		// Log before parsing, since parsing in situ modifies the message
+		log(::action::simulator_response,
+				static_cast<const char*>(rspns.data()),
 				rspns.size());
 		
-		return response((const char* const)rspns.data(), rspns.size());
+		incoming->parse();
+		
+		return *incoming;
+	}
+	
+	void client::log(const action topic, const char* const data, const std::size_t size) {
+		if(LIKELY(size == 0 || (unsigned char)data[0] != SIMULATOR_BINARY_MAGIC)) {
+			logger->put(topic, data, size);
+			return;
+		}
+		
+		logger->put_binary(topic, data, size);
 	}
 }
@@ -4,11 +4,29 @@
 #include <common.hpp>
 #include <action.hpp>
 #include "../diagnostics/logger.hpp"
+#include "protocol.hpp"
 #include "response.hpp"
 #include "request.hpp"
+#include <stdexcept>
 #include <zmq.hpp>
 
 namespace simulator {
+	/**
+	 * \brief Thrown when a network problem prevented a call from completing.
+	 * 
+	 * The simulator never saw the request or we never saw its reply, so the call may be
+	 * retried elsewhere.
+	 */
+	class network_error : public std::runtime_error {
+	 public:
+		/**
+		 * \brief Constructor takes the error message.
+		 */
+		explicit network_error(const char* const what)
+				: std::runtime_error(what) {
+		}
+	};
+	
 	/**
 	 * \brief A client used to connect to a simulation server.
 	 */
@@ -16,7 +34,7 @@ namespace simulator {
 	 public:
 		/**
 		 * \brief Constructor takes an endpoint to bind to, along with an optional logger.
-		 *
+		 * 
 		 * The format should be transport://address where transport is the transport
 		 * protocol to be used and address is specific to the transport protocol. For
 		 * example a TCP connection on localhost could be tcp://127.0.0.1:12345. When
@@ -54,16 +72,123 @@ namespace simulator {
 		
 		/**
 		 * \brief Set the send and receive timeout.
+		 * 
+		 * The receive timeout is the default deadline of call(). Set it to -1 to impose
+		 * no deadline.
 		 */
 		void set_timeout(const int sendTimeout, const int receiveTimeout);
 		
 		/**
-		 * \brief Send a request to the server and receive a response.
+		 * \brief Discard the socket and connect a new one to the same endpoint.
+		 * 
+		 * A REQ socket whose call failed is left waiting for a reply that may never come,
+		 * so it must be replaced before it can be used again. Any unsent request is
+		 * dropped.
+		 */
+		void reconnect();
+		
+		/**
+		 * \brief Return the endpoint we are connected to.
+		 */
+		inline const char* get_endpoint() const {
+			return endpoint;
+		}
+		
+		/**
+		 * \brief Ask the simulator whether it speaks the binary encoding and use it for
+		 * every call from now on if it does.
+		 * 
+		 * Simulators that do not know about the binary encoding reply with an error, so
+		 * we keep using JSON with them. This is also the case if the simulator does not
+		 * reply at all.
+		 * 
+		 * \returns whether the binary encoding is used.
+		 */
+		bool negotiate();
+		
+		/**
+		 * \brief Set the encoding of every call from now on, without asking the
+		 * simulator.
+		 */
+		inline void set_encoding(const encoding E) {
+			enc = E;
+		}
+		
+		/**
+		 * \brief Return the encoding of our calls.
+		 */
+		inline encoding get_encoding() const {
+			return enc;
+		}
+		
+		/**
+		 * \brief Return the request of this client, reset to call a method.
+		 * 
+		 * The request is reused by every call, so it must be passed to call() before
+		 * prepare() is called again.
+		 */
+		inline request* prepare(const method M) {
+			if(UNLIKELY(!outgoing->reclaim())) {
+				// zmq still refers to the last request, which only happens after a call
+				// was abandoned. The request now belongs to zmq, so we need a new one.
+				outgoing = new request();
+			}
+			
+			return outgoing->reset(M, enc);
+		}
+		
+		/**
+		 * \brief Send a request to the server and receive a response within the default
+		 * deadline given by set_timeout().
+		 * 
+		 * The request must have been returned by prepare(). The response is owned by
+		 * this client and is only valid until the next call.
+		 * 
+		 * \throws network_error if a network problem has prevented us from sending or
+		 * receiving the request. A timeout will also throw this exception.
+		 */
+		const response& call(request* request);
+		
+		/**
+		 * \brief Send a request to the server and receive a response within deadline
+		 * milliseconds, or without a deadline if it is -1.
+		 * 
+		 * If the deadline passes or a network operation fails, the socket is
+		 * reconnected so the client is usable again and network_error is thrown. If the
+		 * call was hedged and the partner answered first, the response is owned by the
+		 * partner.
+		 * 
+		 * \throws network_error if a network problem has prevented us from sending or
+		 * receiving the request. A timeout will also throw this exception.
+		 */
+		const response& call(request* request, const int deadline);
+		
+		/**
+		 * \brief Hedge the next call to another client.
 		 * 
-		 * \throws std::runtime_exception if a network problem has prevented us from
-		 * sending or receiving the request. A timeout will also throw this exception.
+		 * If the next call has not been answered after delay microseconds, the same
+		 * request is also sent through partner and whichever reply arrives first is
+		 * returned. The client that loses is reconnected. This only applies to the next
+		 * call.
+		 */
+		inline void set_hedge(client* const partner, const std::uint_fast64_t delay) {
+			hedgePartner = partner;
+			hedgeDelay = delay;
+		}
+		
+		/**
+		 * \brief Return whether the last call was also sent to the hedge partner.
 		 */
-		response call(request* request);
+		inline bool hedge_fired() const {
+			return hedgeFired;
+		}
+		
+		/**
+		 * \brief Return whether the reply of the last call came from the hedge partner.
+		 */
+		inline bool hedge_won() const {
+			return hedgeWon;
+		}
 	
 	 private:
 		/**
@@ -89,6 +214,26 @@ namespace simulator {
 		 */
 		::zmq::socket_t socket;
 		
+		/**
+		 * \brief The request reused by every call.
+		 * 
+		 * \note We own this memory unless it has been orphaned to zmq, see
+		 * request::reclaim().
+		 */
+		request* outgoing;
+		
+		/**
+		 * \brief The response reused by every call.
+		 * 
+		 * \note We own this memory.
+		 */
+		response* incoming;
+		
+		/**
+		 * \brief The encoding of our calls.
+		 */
+		encoding enc;
+		
 		/**
 		 * \brief The timeout when sending data to the endpoint.
 		 */
@@ -98,6 +243,41 @@ namespace simulator {
 		 * \brief The timeout when receiving data to the endpoint.
 		 */
 		int receiveTimeout;
+		
+		/**
+		 * \brief The client the next call is hedged to, if any.
+		 */
+		client* hedgePartner;
+		
+		/**
+		 * \brief How long the next call waits before it is hedged.
+		 * 
+		 * \note Microseconds.
+		 */
+		std::uint_fast64_t hedgeDelay;
+		
+		/**
+		 * \brief Whether the last call was also sent to the hedge partner.
+		 */
+		bool hedgeFired;
+		
+		/**
+		 * \brief Whether the reply of the last call came from the hedge partner.
+		 */
+		bool hedgeWon;
+		
+		/**
+		 * \brief Log a request or a response.
+		 * 
+		 * The logger expects JSON, so a binary message is logged as a string of hex
+		 * digits, see diagnostics::logger::put_binary().
+		 */
+		void log(const action topic, const char* const data, const std::size_t size);
+		
+		/**
+		 * \brief Receive and parse a reply that poll() has already found waiting.
+		 */
+		const response& receive();
 	};
 }
 
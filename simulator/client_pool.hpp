@@ -8,7 +8,7 @@
 /**
  * \brief The maximum size of the pool (stored in stack)
  */
-#define SIMULATOR_CLIENT_POOL_MAX_SIZE 4
+#define SIMULATOR_CLIENT_POOL_MAX_SIZE 8
 
 /**
  * \brief The default client timeout when sending.
@@ -19,13 +19,14 @@
 #define SIMULATOR_CLIENT_POOL_SENDTO 200
 
 /**
- * \brief The default client timeout when receiving.
+ * \brief The default client deadline for receiving a reply.
  *
- * Setting this to anything other than -1 imposes a timeout which means our client may
- * throw an exception because the simulator hasn't responded before the timeout, which is
- * not normally something we want. Set to -1 to impose no timeout.
+ * A call that has not been answered within this is abandoned. Its socket is reconnected
+ * and the client throws an exception, which lets the call fail over to another simulator.
+ * Set this comfortably above the slowest simulation you expect. Set to -1 to impose no
+ * deadline, in which case a stuck simulator blocks the calling thread forever.
  */
-#define SIMULATOR_CLIENT_POOL_RECVTO -1
+#define SIMULATOR_CLIENT_POOL_RECVTO 10000
 
 namespace simulator {
 	/**
@@ -72,9 +73,8 @@ namespace simulator {
 		 * Setting the sendTimeout too low may result a client will throw an exception
 		 * because the endpoint was too busy to respond within the timeout.
 		 * 
-		 * Setting the receiveTimeout to anything other than -1 imposes a timeout which
-		 * means our client may throw an exception because the endpoint hasn't responded
-		 * before the timeout, which is not normally something we want.
+		 * The receiveTimeout is the deadline for each call. A call whose endpoint hasn't
+		 * responded by then throws an exception and leaves the client reconnected.
 		 */
 		void add(const char* const endpoint,
 				::diagnostics::logger* const logger = 0,
@@ -0,0 +1,157 @@
+#ifndef _SIMULATOR_PROTOCOL_HPP
+#define _SIMULATOR_PROTOCOL_HPP
+
+#include <common.hpp>
+#include <cstdint>
+#include <little_endian.hpp>
+
+/**
+ * \brief The first byte of every binary frame.
+ * 
+ * No JSON document can start with this byte, so the simulator tells the two encodings
+ * apart by looking at the first byte of a request.
+ */
+#define SIMULATOR_BINARY_MAGIC 0xB5
+
+/**
+ * \brief The version of the binary encoding we speak.
+ */
+#define SIMULATOR_BINARY_VERSION 1
+
+/**
+ * \brief The size of the header of a binary frame.
+ * 
+ * The header is the magic byte, the version byte, the method id byte, the flags byte
+ * and the number of bytes that follow the header as a 32 bit unsigned int.
+ * 
+ * \note Bytes.
+ */
+#define SIMULATOR_BINARY_HEADER_SIZE 8
+
+/**
+ * \brief The flag of a binary response that carries an error instead of a result.
+ */
+#define SIMULATOR_BINARY_FLAG_ERROR 0x01
+
+namespace simulator {
+	/**
+	 * \brief The encodings of the messages exchanged with a simulator.
+	 */
+	enum class encoding {
+		/**
+		 * \brief Every simulator speaks JSON.
+		 */
+		json,
+		
+		/**
+		 * \brief Compact binary frames, which must be negotiated first.
+		 * 
+		 * Every value is little-endian. The parameters of a request follow the header in
+		 * the order of their JSON counterparts, without any type information:
+		 * - integers are 64 bits and signed where the JSON parameter is signed,
+		 * - doubles are IEEE 754 binary64,
+		 * - chars are a single byte,
+		 * - strings are a 32 bit length followed by the bytes without a null terminator,
+		 * - arrays are a 32 bit count followed by the elements.
+		 * 
+		 * The result of a response is encoded the same way, bools as a single byte, except
+		 * for measurement results, which are a 32 bit bit count followed by the bits
+		 * packed into bytes with the first measurement in the most significant bit of the
+		 * first byte. A response with SIMULATOR_BINARY_FLAG_ERROR set carries an error
+		 * message string instead.
+		 */
+		binary
+	};
+	
+	/**
+	 * \brief The methods a simulator provides.
+	 * 
+	 * The enum value is the method id of a binary frame.
+	 * 
+	 * \warning Order must correspond to _methods[].
+	 */
+	enum class method : std::uint8_t {
+		get_uniform_integer,
+		get_uniform_real,
+		get_weighted_integer,
+		create_system,
+		delete_system,
+		create_state,
+		delete_state,
+		modify_state,
+		measure_state,
+		compute_result,
+		
+		// Always JSON
+		negotiate,
+		
+		_COUNT
+	};
+	
+	/**
+	 * \brief Metadata for a method enum value.
+	 */
+	struct _method {
+		/**
+		 * \brief The null terminated string.
+		 */
+		const char* str;
+		
+		/**
+		 * \brief The size of str excluding the null terminator.
+		 */
+		const std::size_t size;
+	};
+	
+	#define DECLARE_METHOD(str) {str, sizeof(str)-1}
+	
+	/**
+	 * \brief The corresponding metadata for each method enum value.
+	 * 
+	 * \warning Order must correspond to method.
+	 */
+	constexpr _method _methods[11] = {
+			DECLARE_METHOD("get_uniform_integer"),
+			DECLARE_METHOD("get_uniform_real"),
+			DECLARE_METHOD("get_weighted_integer"),
+			DECLARE_METHOD("create_system"),
+			DECLARE_METHOD("delete_system"),
+			DECLARE_METHOD("create_state"),
+			DECLARE_METHOD("delete_state"),
+			DECLARE_METHOD("modify_state"),
+			DECLARE_METHOD("measure_state"),
+			DECLARE_METHOD("compute_result"),
+			DECLARE_METHOD("negotiate"),
+	};
+	
+	static_assert(ARRAY_LENGTH(_methods) == enum_value<method>(method::_COUNT),
+			"Missing element in _methods");
+	
+	/**
+	 * \brief Return the corresponding string for a given method in _methods.
+	 */
+	constexpr const char* method_str(const method M) {
+		#ifdef THROW
+		if(UNLIKELY(M == method::_COUNT)) {
+			throw std::invalid_argument(err_msg::_arybnds);
+		}
+		#endif
+		
+		return _methods[enum_value<method>(M)].str;
+	}
+	
+	/**
+	 * \brief Return the corresponding size for a given method in _methods.
+	 */
+	constexpr std::size_t method_str_size(const method M) {
+		#ifdef THROW
+		if(UNLIKELY(M == method::_COUNT)) {
+			throw std::invalid_argument(err_msg::_arybnds);
+		}
+		#endif
+		
+		return _methods[enum_value<method>(M)].size;
+	}
+}
+
+#endif
@@ -2,34 +2,59 @@
 #define _SIMULATOR_REQUEST_HPP
 
 #include <common.hpp>
-#include <rapidjson/document.h>
+#include "protocol.hpp"
+#include <atomic>
+#include <initializer_list>
+#include <vector>
 #include <rapidjson/stringbuffer.h>
 #include <rapidjson/writer.h>
 
 namespace simulator {
+	/**
+	 * \brief A string parameter given as null terminated fragments, which are sent as
+	 * if they had been concatenated.
+	 */
+	typedef std::initializer_list<const char*> fragments;
+	
 	/**
 	 * \brief An RPC request for the server.
+	 * 
+	 * The request is written straight into a buffer as parameters are added, without
+	 * building a DOM, either as JSON or as a binary frame. A client owns a single request
+	 * that it resets for every call, so once the buffer has grown to the largest request
+	 * no further allocation is made.
 	 */
 	struct request {
-	 public:
+	 private:
 		/**
-		 * \brief Constructor accepts the method name to call.
+		 * \brief Who currently owns the buffer.
 		 */
-		request(const char* const method)
-				: _dom(), _allocator(_dom.GetAllocator()) {
-			#ifdef THROW
-			if(method == nullptr) {
-				throw std::invalid_argument("null pointer");
-			}
-			#endif
+		enum class state : int {
+			/**
+			 * \brief Only the client refers to the buffer.
+			 */
+			idle,
+			
+			/**
+			 * \brief A zmq message still refers to the buffer.
+			 */
+			sent,
 			
-			_dom.SetObject();
-			_dom.AddMember("method",
-					::rapidjson::Value(method, _allocator),
-					_allocator);
-			_dom.AddMember("parameters",
-					::rapidjson::Value(::rapidjson::kArrayType),
-					_allocator);
+			/**
+			 * \brief A zmq message still refers to the buffer, but the client has given
+			 * up on the request, so freeing the message deletes it.
+			 */
+			orphaned
+		};
+	
+	 public:
+		/**
+		 * \brief Constructor.
+		 */
+		request()
+				: _writer(_buffer),
+				_binary(false),
+				_state(enum_value(state::idle)) {
 		}
 		
 		/**
@@ -38,26 +63,55 @@ namespace simulator {
 		request(const request&) = delete;
 		
 		/**
-		 * \brief Move constructor.
+		 * \brief Move constructor is disabled.
+		 * 
+		 * A zmq message may refer to our buffer, so we must stay where we are.
 		 */
-		request(request&& old)
-				: _dom(std::move(old._dom)),
-				_allocator(old._allocator) {
-		}
+		request(request&&) = delete;
 		
 		/**
 		 * \brief Assignment operator is disabled.
 		 */
-		request& operator=(const request&) = delete; 
+		request& operator=(const request&) = delete;
 		
 		/**
-		 * \brief Move assignment operator.
+		 * \brief Move assignment operator is disabled.
 		 */
-		request& operator=(request&& old) {
-			_dom = std::move(old._dom);
-			_allocator = old._allocator;
+		request& operator=(request&&) = delete;
+		
+		/**
+		 * \brief Start a new request that calls a method, discarding the previous one.
+		 * 
+		 * This returns a pointer to the current object as to implement a fluent
+		 * interface.
+		 * 
+		 * \warning The buffer must have been reclaimed first, see reclaim().
+		 */
+		inline request* reset(const method M, const encoding E = encoding::json) {
+			_buffer.Clear();
+			_binary = (E == encoding::binary);
+			
+			if(_binary) {
+				// The length is filled in by generate()
+				char* header = _buffer.Push(SIMULATOR_BINARY_HEADER_SIZE);
+				header[0] = (char)SIMULATOR_BINARY_MAGIC;
+				header[1] = SIMULATOR_BINARY_VERSION;
+				header[2] = (char)enum_value<method>(M);
+				header[3] = 0;
+				little_endian::put<std::uint32_t>(&header[4], 0);
+				
+				return this;
+			}
 			
-			return *this;
+			_writer.Reset(_buffer);
+			
+			_writer.StartObject();
+			_writer.Key("method", 6);
+			_writer.String(method_str(M), method_str_size(M));
+			_writer.Key("parameters", 10);
+			_writer.StartArray();
+			
+			return this;
 		}
 		
 		/**
@@ -66,59 +120,159 @@ namespace simulator {
 		 * This returns a pointer to the current object as to implement a fluent
 		 * interface.
 		 * 
-		 * The reallocate template parameter signifies whether or not we are to reallocate
-		 * the data when adding it to our request. This is by default true, which doesn't
-		 * make a difference when dealing with numeric types. However for cstring this
-		 * means we can skip a reallocation of the string.
+		 * The reallocate template parameter is kept for compatibility. Parameters are
+		 * always written straight into the buffer, so it makes no difference.
 		 * 
 		 * \warning You must use a template specialized function.
 		 */
 		template <typename T, bool reallocate = true> inline request* add(T data);
 		
 		/**
-		 * \brief Generate the JSON null terminated cstring of the object.
+		 * \brief Finish the encoded request.
 		 */
 		inline void generate() {
-			::rapidjson::Writer<::rapidjson::StringBuffer> writer(_jsonBuffer);
-			_dom.Accept(writer);
+			if(_binary) {
+				// The header is at the start of the buffer, which GetString() exposes
+				little_endian::put<std::uint32_t>(const_cast<char*>(_buffer.GetString()) + 4,
+						(std::uint32_t)(_buffer.GetSize() - SIMULATOR_BINARY_HEADER_SIZE));
+				return;
+			}
+			
+			_writer.EndArray();
+			_writer.EndObject();
 		}
 		
 		/**
-		 * \brief Return a JSON null terminated cstring of the object.
+		 * \brief Return the encoded request.
+		 * 
+		 * A JSON request is a null terminated cstring.
 		 * 
-		 * \note Use get_json_size() for the length of this.
+		 * \note Use get_encoded_size() for the length of this.
 		 */
-		inline const char* get_json_encoded(const bool regenerate = false) {
-			if(regenerate) {
-				generate();
-			}
-			
-			return _jsonBuffer.GetString();
+		inline const char* get_encoded() const {
+			return _buffer.GetString();
+		}
+		
+		/**
+		 * \brief Return the length of the encoded request, which includes the null
+		 * terminator of a JSON request.
+		 */
+		inline std::size_t get_encoded_size() const {
+			return _buffer.GetSize() + (_binary ? 0 : 1);
+		}
+		
+		/**
+		 * \brief Return whether the request is a binary frame.
+		 */
+		inline bool is_binary() const {
+			return _binary;
+		}
+		
+		/**
+		 * \brief Mark the buffer as referred to by a zmq message that frees it with
+		 * release().
+		 */
+		inline void set_sent() {
+			_state = enum_value(state::sent);
+		}
+		
+		/**
+		 * \brief Try to take the buffer back from zmq so it can be reset.
+		 * 
+		 * \returns true if no zmq message refers to the buffer anymore. Otherwise the
+		 * request is handed over to the zmq message, which deletes it when it is freed,
+		 * and false is returned.
+		 */
+		inline bool reclaim() {
+			int expected = enum_value(state::sent);
+			return !_state.compare_exchange_strong(expected, enum_value(state::orphaned));
 		}
 		
 		/**
-		 * \brief Return a the length of the JSON string.
+		 * \brief The zmq free function of messages that refer to our buffer.
+		 * 
+		 * The hint is the request.
 		 */
-		inline std::size_t get_json_size() const {
-			return _jsonBuffer.GetSize();
+		static void release(void* data, void* hint) {
+			UNUSED(data);
+			auto rqst = static_cast<request*>(hint);
+			if(rqst->_state.exchange(enum_value(state::idle)) == enum_value(state::orphaned)) {
+				delete rqst;
+			}
 		}
 	
 	 private:
 		/**
-		 * \brief The rapidjson dom model we use to store our request until json
-		 * generation.
+		 * \brief The rapidjson Buffer that holds our encoded request.
+		 */
+		::rapidjson::StringBuffer _buffer;
+		
+		/**
+		 * \brief The rapidjson writer that streams JSON into our buffer.
+		 */
+		::rapidjson::Writer<::rapidjson::StringBuffer> _writer;
+		
+		/**
+		 * \brief Whether the request is a binary frame rather than JSON.
 		 */
-		::rapidjson::Document _dom;
+		bool _binary;
 		
 		/**
-		 * \brief The allocator for the rapidjson document, used for faster access.
+		 * \brief Who currently owns the buffer.
 		 */
-		std::reference_wrapper<rapidjson::Document::AllocatorType> _allocator;
+		std::atomic<int> _state;
 		
 		/**
-		 * \brief The rapidjson Buffer that holds our JSON string.
+		 * \brief Append a little-endian value to a binary frame.
 		 */
-		::rapidjson::StringBuffer _jsonBuffer;
+		template <typename T> inline void put(const T data) {
+			little_endian::put<T>(_buffer.Push(sizeof(T)), data);
+		}
+		
+		/**
+		 * \brief Append a cstring to a JSON string that has been opened by hand, escaping
+		 * it like the writer does.
+		 */
+		inline void put_escaped(const char* str) {
+			static const char hex[] = "0123456789ABCDEF";
+			
+			for(; *str != '\0'; str++) {
+				const unsigned char ch = (unsigned char)*str;
+				if(LIKELY(ch >= 0x20 && ch != '"' && ch != '\\')) {
+					_buffer.Put((char)ch);
+					continue;
+				}
+				
+				_buffer.Put('\\');
+				switch(ch) {
+				 case '"':
+				 case '\\':
+					_buffer.Put((char)ch);
+					break;
+				 case '\b':
+					_buffer.Put('b');
+					break;
+				 case '\f':
+					_buffer.Put('f');
+					break;
+				 case '\n':
+					_buffer.Put('n');
+					break;
+				 case '\r':
+					_buffer.Put('r');
+					break;
+				 case '\t':
+					_buffer.Put('t');
+					break;
+				 default:
+					_buffer.Put('u');
+					_buffer.Put('0');
+					_buffer.Put('0');
+					_buffer.Put(hex[ch >> 4]);
+					_buffer.Put(hex[ch & 0xF]);
+				}
+			}
+		}
 	};
 	
 	/**
@@ -132,9 +286,58 @@ namespace simulator {
 		}
 		#endif
 		
-		_dom["parameters"].PushBack(
-				::rapidjson::Value().SetString(::rapidjson::StringRef(data)),
-				_allocator);
+		const std::size_t size = strlen(data);
+		if(_binary) {
+			put<std::uint32_t>((std::uint32_t)size);
+			memcpy(_buffer.Push(size), data, size);
+		} else {
+			_writer.String(data, size);
+		}
+		
+		return this;
+	}
+	
+	/**
+	 * \brief Add a cstring given as fragments to the parameter array.
+	 * 
+	 * The fragments are written straight into the request one after the other, so
+	 * they need not be concatenated first.
+	 */
+	template <> inline request*
+			request::add<fragments>(fragments data) {
+		#ifdef THROW
+		for(auto fragment : data) {
+			if(fragment == 0) {
+				throw std::invalid_argument("null pointer");
+			}
+		}
+		#endif
+		
+		if(_binary) {
+			std::size_t size = 0;
+			for(auto fragment : data) {
+				size += strlen(fragment);
+			}
+			
+			put<std::uint32_t>((std::uint32_t)size);
+			char* p = _buffer.Push(size);
+			for(auto fragment : data) {
+				const std::size_t fragmentSize = strlen(fragment);
+				memcpy(p, fragment, fragmentSize);
+				p += fragmentSize;
+			}
+			
+			return this;
+		}
+		
+		// An empty raw value lets the writer place the separator, then the string
+		// itself goes straight into the buffer it writes to
+		_writer.RawValue("", 0, ::rapidjson::kStringType);
+		_buffer.Put('"');
+		for(auto fragment : data) {
+			put_escaped(fragment);
+		}
+		_buffer.Put('"');
 		
 		return this;
 	}
@@ -144,7 +347,11 @@ namespace simulator {
 	 */
 	template <> inline request*
 			request::add<char>(char data) {
-		_dom["parameters"].PushBack(data, _allocator);
+		if(_binary) {
+			put<char>(data);
+		} else {
+			_writer.Int(data);
+		}
 		
 		return this;
 	}
@@ -154,7 +361,11 @@ namespace simulator {
 	 */
 	template <> inline request*
 			request::add<unsigned long int>(unsigned long int data) {
-		_dom["parameters"].PushBack(data, _allocator);
+		if(_binary) {
+			put<std::uint64_t>(data);
+		} else {
+			_writer.Uint64(data);
+		}
 		
 		return this;
 	}
@@ -164,7 +375,11 @@ namespace simulator {
 	 */
 	template <> inline request*
 			request::add<long int>(long int data) {
-		_dom["parameters"].PushBack(data, _allocator);
+		if(_binary) {
+			put<std::int64_t>(data);
+		} else {
+			_writer.Int64(data);
+		}
 		
 		return this;
 	}
@@ -174,7 +389,11 @@ namespace simulator {
 	 */
 	template <> inline request*
 			request::add<double>(double data) {
-		_dom["parameters"].PushBack(data, _allocator);
+		if(_binary) {
+			put<double>(data);
+		} else {
+			_writer.Double(data);
+		}
 		
 		return this;
 	}
@@ -184,11 +403,19 @@ namespace simulator {
 	 */
 	template <> inline request*
 			request::add<std::vector<double>&&>(std::vector<double>&& data) {
-		::rapidjson::Value values(::rapidjson::kArrayType);
+		if(_binary) {
+			put<std::uint32_t>((std::uint32_t)data.size());
+			for(auto i : data) {
+				put<double>(i);
+			}
+			return this;
+		}
+		
+		_writer.StartArray();
 		for(auto i : data) {
-			values.PushBack(i, _allocator);
+			_writer.Double(i);
 		}
-		_dom["parameters"].PushBack(values, _allocator);
+		_writer.EndArray();
 		
 		return this;
 	}
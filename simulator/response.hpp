@@ -2,25 +2,65 @@
 #define _SIMULATOR_RESPONSE_HPP
 
 #include <common.hpp>
+#include "protocol.hpp"
+#include <cstddef>
+#include <vector>
 #include <rapidjson/document.h>
-#include <rapidjson/memorystream.h>
-#include <rapidjson/writer.h>
+#include <zmq.hpp>
+
+/**
+ * \brief The size of the memory the values of a response are allocated from before
+ * falling back to the heap.
+ * 
+ * \note Bytes.
+ */
+#define SIMULATOR_RESPONSE_VALUE_POOL_SIZE 4096
+
+/**
+ * \brief The size of the memory the parser stack of a response is allocated from before
+ * falling back to the heap.
+ * 
+ * \note Bytes.
+ */
+#define SIMULATOR_RESPONSE_STACK_POOL_SIZE 1024
 
 namespace simulator {
 	/**
-	 * \brief A JSON response from the simulator.
+	 * \brief A JSON or binary response from the simulator.
 	 * 
-	 * All responses are UTF-8.
+	 * All responses are UTF-8. The encoding is told apart by the first byte, see
+	 * SIMULATOR_BINARY_MAGIC, so a response is always decoded the way it was sent.
+	 * 
+	 * A client owns a single response that it reuses for every call. The reply is
+	 * parsed in situ in the zmq message it arrived in, and the values are allocated from
+	 * memory pools that are cleared before every parse, so strings are never copied and
+	 * nothing is allocated unless a reply outgrows the pools.
 	 */
 	struct response {
+	 private:
+		/**
+		 * \brief The type of the pool allocators.
+		 */
+		typedef ::rapidjson::MemoryPoolAllocator<> allocator_t;
+		
+		/**
+		 * \brief The type of the DOM, which allocates both its values and its parser
+		 * stack from pools.
+		 */
+		typedef ::rapidjson::GenericDocument<::rapidjson::UTF8<>, allocator_t, allocator_t> document_t;
+	
 	 public:
 		/**
-		 * \brief Decoding constructor takes in a JSON cstring that does not have a null
-		 * termination.
+		 * \brief Constructor.
 		 */
-		response(const char* const data, const std::size_t size) {
-			::rapidjson::MemoryStream ms(data, size);
-			_dom.ParseStream(ms);
+		response()
+				: _valueAllocator(_valuePool, sizeof(_valuePool)),
+				_stackAllocator(_stackPool, sizeof(_stackPool)),
+				_dom(&_valueAllocator, SIMULATOR_RESPONSE_STACK_POOL_SIZE/2, &_stackAllocator),
+				_binary(false),
+				_flags(0),
+				_payload(nullptr),
+				_payloadSize(0) {
 		}
 		
 		/**
@@ -29,11 +69,11 @@ namespace simulator {
 		response(const response&) = delete;
 		
 		/**
-		 * \brief Move constructor.
+		 * \brief Move constructor is disabled.
+		 * 
+		 * The allocators refer to our pools, so we must stay where we are.
 		 */
-		response(response&& old)
-				: _dom(std::move(old._dom)) {
-		}
+		response(response&&) = delete;
 		
 		/**
 		 * \brief Assignment operator is disabled.
@@ -41,18 +81,78 @@ namespace simulator {
 		response& operator=(const response&) = delete; 
 		
 		/**
-		 * \brief Move assignment operator.
+		 * \brief Move assignment operator is disabled.
 		 */
-		response& operator=(response&& old) {
-			_dom = std::move(old._dom);
+		response& operator=(response&&) = delete;
+		
+		/**
+		 * \brief Return the message the next reply is received into.
+		 * 
+		 * \warning Receiving into it invalidates every result of the previous reply.
+		 */
+		inline ::zmq::message_t& message() {
+			return _message;
+		}
+		
+		/**
+		 * \brief Parse the reply held by message() in situ.
+		 * 
+		 * \warning This modifies the message, so log it first.
+		 */
+		void parse() {
+			const std::size_t size = _message.size();
+			const char* const data = static_cast<const char*>(_message.data());
 			
-			return *this;
+			_binary = (size > 0 && (unsigned char)data[0] == SIMULATOR_BINARY_MAGIC);
+			if(_binary) {
+				// A binary frame needs no parsing, only the header is checked
+				if(UNLIKELY(size < SIMULATOR_BINARY_HEADER_SIZE ||
+						data[1] != SIMULATOR_BINARY_VERSION ||
+						little_endian::get<std::uint32_t>(&data[4]) != size - SIMULATOR_BINARY_HEADER_SIZE)) {
+					_flags = SIMULATOR_BINARY_FLAG_ERROR;
+					_payload = nullptr;
+					_payloadSize = 0;
+					return;
+				}
+				
+				_flags = (std::uint8_t)data[3];
+				_payload = &data[SIMULATOR_BINARY_HEADER_SIZE];
+				_payloadSize = size - SIMULATOR_BINARY_HEADER_SIZE;
+				return;
+			}
+			
+			// The memory of the previous reply is released all at once. rapidjson never
+			// frees pool memory on its own, so the old DOM is safe to overwrite.
+			_valueAllocator.Clear();
+			_stackAllocator.Clear();
+			
+			char* json = static_cast<char*>(_message.data());
+			if(UNLIKELY(size == 0 || json[size-1] != '\0')) {
+				// In situ parsing needs a null terminated string, which we send but a
+				// simulator might not. The buffer keeps its capacity between calls.
+				_terminated.assign(json, json + size);
+				_terminated.push_back('\0');
+				json = _terminated.data();
+			}
+			
+			_dom.ParseInsitu<::rapidjson::kParseStopWhenDoneFlag>(json);
 		}
 		
 		/**
 		 * \brief Return whether or not an error has occured.
+		 * 
+		 * A reply that is neither valid JSON nor a valid binary frame is an error as
+		 * well.
 		 */
 		inline bool error() const {
+			if(_binary) {
+				return (_flags & SIMULATOR_BINARY_FLAG_ERROR);
+			}
+			
+			if(UNLIKELY(_dom.HasParseError() || !_dom.IsObject())) {
+				return true;
+			}
+			
 			// If we have the error field we probably have it set to true
 			if(_dom.HasMember("error") && LIKELY(_dom["error"].GetBool())) {
 				return true;
@@ -66,30 +166,154 @@ namespace simulator {
 		 * \warning This requires that the result be an array.
 		 */
 		inline std::size_t result_size() const {
+			if(_binary) {
+				return little_endian::get<std::uint32_t>(field(0, 4));
+			}
+			
 			return _dom["result"].Size();
 		}
 		
 		/**
 		 * \brief Return a type T result.
 		 * 
+		 * Strings are returned as pointers into the message, so they are only valid
+		 * until the next call of the client.
+		 * 
 		 * \warning You must use a template specialized function.
 		 */
 		template <typename T> inline T result() const;
+		
+		/**
+		 * \brief Return a string of binary digits result decoded as an integer.
+		 * 
+		 * The first digit is the most significant bit, and any digit other than 1 is
+		 * taken as 0.
+		 * 
+		 * \warning This requires that the result has no more than 64 digits.
+		 */
+		inline std::uint_fast64_t result_bits() const {
+			if(_binary) {
+				// Packed bits, the first in the most significant bit of the first byte
+				const std::size_t count = little_endian::get<std::uint32_t>(field(0, 4));
+				const char* const bytes = field(4, (count + 7)/8);
+				
+				std::uint_fast64_t bits = 0;
+				for(std::size_t i = 0; i < count; i++) {
+					bits = (bits << 1) | (((unsigned char)bytes[i/8] >> (7 - i%8)) & 1);
+				}
+				
+				return bits;
+			}
+			
+			const auto& value = _dom["result"];
+			const char* const digits = value.GetString();
+			const std::size_t size = value.GetStringLength();
+			
+			std::uint_fast64_t bits = 0;
+			for(std::size_t i = 0; i < size; i++) {
+				bits = (bits << 1) | (digits[i] == '1');
+			}
+			
+			return bits;
+		}
 	
 	 private:
+		/**
+		 * \brief The message holding the reply, which the DOM strings point into.
+		 */
+		::zmq::message_t _message;
+		
+		/**
+		 * \brief A null terminated copy of a reply that arrived without one.
+		 */
+		std::vector<char> _terminated;
+		
+		/**
+		 * \brief The memory the values are allocated from first.
+		 */
+		alignas(std::max_align_t) char _valuePool[SIMULATOR_RESPONSE_VALUE_POOL_SIZE];
+		
+		/**
+		 * \brief The memory the parser stack is allocated from first.
+		 */
+		alignas(std::max_align_t) char _stackPool[SIMULATOR_RESPONSE_STACK_POOL_SIZE];
+		
+		/**
+		 * \brief The allocator of the values.
+		 */
+		allocator_t _valueAllocator;
+		
+		/**
+		 * \brief The allocator of the parser stack.
+		 */
+		allocator_t _stackAllocator;
+		
 		/**
 		 * \brief The rapidjson DOM which contains parsed values.
 		 * 
 		 * Uses UTF-8 by default.
 		 */
-		::rapidjson::Document _dom;
+		document_t _dom;
+		
+		/**
+		 * \brief Whether the reply is a binary frame rather than JSON.
+		 */
+		bool _binary;
+		
+		/**
+		 * \brief The flags of a binary reply.
+		 */
+		std::uint8_t _flags;
+		
+		/**
+		 * \brief The bytes following the header of a binary reply.
+		 */
+		const char* _payload;
+		
+		/**
+		 * \brief The number of bytes following the header of a binary reply.
+		 */
+		std::size_t _payloadSize;
+		
+		/**
+		 * \brief Return the size bytes at offset into the payload of a binary reply.
+		 * 
+		 * \throws std::runtime_error if the reply is too short.
+		 */
+		inline const char* field(const std::size_t offset, const std::size_t size) const {
+			if(UNLIKELY(offset + size > _payloadSize)) {
+				throw std::runtime_error("Simulator returned truncated response");
+			}
+			
+			return &_payload[offset];
+		}
 	};
 	
+	/**
+	 * \brief Return a view of a string result.
+	 */
+	template <> inline str_view
+			response::result<str_view>() const {
+		if(_binary) {
+			const std::size_t size = little_endian::get<std::uint32_t>(field(0, 4));
+			return str_view(field(4, size), size);
+		}
+		
+		const auto& value = _dom["result"];
+		return str_view(value.GetString(), value.GetStringLength());
+	}
+	
 	/**
 	 * \brief Return a cstring result.
+	 * 
+	 * \warning Strings of a binary reply are not null terminated, use str_view instead.
 	 */
 	template <> inline const char*
 			response::result<const char*>() const {
+		if(UNLIKELY(_binary)) {
+			throw std::runtime_error("Simulator returned binary string");
+		}
+		
 		return _dom["result"].GetString();
 	}
 	
@@ -98,6 +322,10 @@ namespace simulator {
 	 */
 	template <> inline bool
 			response::result<bool>() const {
+		if(_binary) {
+			return (*field(0, 1) != 0);
+		}
+		
 		return _dom["result"].GetBool();
 	}
 	
@@ -106,6 +334,10 @@ namespace simulator {
 	 */
 	template <> inline std::uint_fast64_t
 			response::result<std::uint_fast64_t>() const {
+		if(_binary) {
+			return little_endian::get<std::uint64_t>(field(0, 8));
+		}
+		
 		return _dom["result"].GetUint64();
 	}
 	
@@ -114,6 +346,17 @@ namespace simulator {
 	 */
 	template <> inline std::vector<std::uint_fast64_t>
 			response::result<std::vector<std::uint_fast64_t> >() const {
+		if(_binary) {
+			const std::size_t size = result_size();
+			const char* const elements = field(4, size*8);
+			std::vector<std::uint_fast64_t> array(size);
+			for(std::size_t i = 0; i < size; i++) {
+				array[i] = little_endian::get<std::uint64_t>(&elements[i*8]);
+			}
+			
+			return array;
+		}
+		
 		auto size = _dom["result"].Size();
 		std::vector<std::uint_fast64_t> array(size);
 		for(std::size_t i = 0; i < size; i++) {
@@ -128,6 +371,17 @@ namespace simulator {
 	 */
 	template <> inline std::vector<std::int_fast64_t>
 			response::result<std::vector<std::int_fast64_t> >() const {
+		if(_binary) {
+			const std::size_t size = result_size();
+			const char* const elements = field(4, size*8);
+			std::vector<std::int_fast64_t> array(size);
+			for(std::size_t i = 0; i < size; i++) {
+				array[i] = little_endian::get<std::int64_t>(&elements[i*8]);
+			}
+			
+			return array;
+		}
+		
 		auto size = _dom["result"].Size();
 		std::vector<std::int_fast64_t> array(size);
 		for(std::size_t i = 0; i < size; i++) {
@@ -142,6 +396,17 @@ namespace simulator {
 	 */
 	template <> inline std::vector<double>
 			response::result<std::vector<double> >() const {
+		if(_binary) {
+			const std::size_t size = result_size();
+			const char* const elements = field(4, size*8);
+			std::vector<double> array(size);
+			for(std::size_t i = 0; i < size; i++) {
+				array[i] = little_endian::get<double>(&elements[i*8]);
+			}
+			
+			return array;
+		}
+		
 		auto size = _dom["result"].Size();
 		std::vector<double> array(size);
 		for(std::size_t i = 0; i < size; i++) {
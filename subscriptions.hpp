@@ -0,0 +1,102 @@
+#ifndef _SUBSCRIPTIONS_HPP
+#define _SUBSCRIPTIONS_HPP
+
+#include <common.hpp>
+#include "buffer.hpp"
+#include <mutex>
+#include <unordered_map>
+
+/**
+ * \brief The rx topics that have a live subscription, as told by XPUB sockets.
+ * 
+ * An XPUB socket passes a subscription on when the first subscriber subscribes to it
+ * and passes an unsubscription on when the last one leaves, so each socket adds at
+ * most one to the count of a topic.
+ * 
+ * A subscription to anything other than a whole topic, e.g. to every topic with an
+ * empty prefix, may match any topic, so every topic is observed while there is one.
+ */
+class subscriptions {
+ private:
+	typedef std::lock_guard<std::mutex> lock_t;
+
+ public:
+	/**
+	 * \brief Constructor.
+	 */
+	subscriptions()
+			: _wildcards(0) {
+	}
+	
+	/**
+	 * \brief Copy constructor is disabled.
+	 */
+	subscriptions(const subscriptions&) = delete;
+	
+	/**
+	 * \brief Assignment operator is disabled.
+	 */
+	subscriptions& operator=(const subscriptions&) = delete;
+	
+	/**
+	 * \brief Apply a message received from an XPUB socket.
+	 * 
+	 * The first byte is 1 for a subscription and 0 for an unsubscription, followed by
+	 * the prefix. Any other message is ignored.
+	 * 
+	 * \note Threadsafe
+	 */
+	inline void update(const void* const data, const std::size_t size) {
+		const unsigned char* const bytes = static_cast<const unsigned char*>(data);
+		if(UNLIKELY(size == 0 || bytes[0] > 1)) {
+			return;
+		}
+		
+		const int delta = (bytes[0] == 1 ? 1 : -1);
+		
+		lock_t lock(_mutex);
+		
+		if(size - 1 != sizeof(push_message::topic_t)) {
+			_wildcards += delta;
+			return;
+		}
+		
+		push_message::topic_t topic;
+		memcpy(&topic, &bytes[1], sizeof(topic));
+		
+		int& count = _topics[topic];
+		count += delta;
+		if(count <= 0) {
+			_topics.erase(topic);
+		}
+	}
+	
+	/**
+	 * \brief Return whether anybody may receive a topic.
+	 * 
+	 * \note Threadsafe
+	 */
+	inline bool observed(const push_message::topic_t topic) {
+		lock_t lock(_mutex);
+		
+		return (_wildcards > 0 || _topics.count(topic) != 0);
+	}
+
+ private:
+	/**
+	 * \brief Mutex to protect the counts.
+	 */
+	std::mutex _mutex;
+	
+	/**
+	 * \brief The number of sockets subscribed to each topic.
+	 */
+	std::unordered_map<push_message::topic_t, int> _topics;
+	
+	/**
+	 * \brief The number of subscriptions that may match any topic.
+	 */
+	int _wildcards;
+};
+
+#endif
@@ -31,7 +31,8 @@ if __name__ == '__main__':
                           'configure_node',
                           'rx',
                           'simulator_request',
-                          'simulator_response')
+                          'simulator_response',
+                          'tx_expired')
     parser.add_argument(
             '-a',
             '--action',
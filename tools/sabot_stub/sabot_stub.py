@@ -0,0 +1,196 @@
+import argparse
+import json
+import random
+import struct
+import zmq
+
+# Must match simulator/protocol.hpp
+BINARY_MAGIC = 0xB5
+BINARY_VERSION = 1
+BINARY_FLAG_ERROR = 0x01
+HEADER = struct.Struct('<BBBBI')
+
+# Binary method ids are the order of the methods in simulator/protocol.hpp
+METHODS = ('get_uniform_integer',
+           'get_uniform_real',
+           'get_weighted_integer',
+           'create_system',
+           'delete_system',
+           'create_state',
+           'delete_state',
+           'modify_state',
+           'measure_state',
+           'compute_result')
+
+# Binary parameter shapes of each method: Q = 64 bit unsigned, q = 64 bit signed,
+# d = double, c = char, s = length prefixed string, D = count prefixed double array
+PARAMETERS = {'get_uniform_integer': 'Qqq',
+              'get_uniform_real': 'Qdd',
+              'get_weighted_integer': 'QD',
+              'create_system': 's',
+              'delete_system': 'Q',
+              'create_state': 'Qssc',
+              'delete_state': 'QQ',
+              'modify_state': 'QQssc',
+              'measure_state': 'QQssc',
+              'compute_result': 'Qssc'}
+
+# Binary result shape of each method: as above, plus ? = bool, Q* and q* = count prefixed
+# arrays and b = packed bits
+RESULTS = {'get_uniform_integer': 'q*',
+           'get_uniform_real': 'D',
+           'get_weighted_integer': 'Q*',
+           'create_system': 'Q',
+           'delete_system': '?',
+           'create_state': 'Q',
+           'delete_state': '?',
+           'modify_state': '?',
+           'measure_state': 'b',
+           'compute_result': 'b'}
+
+class Simulator(object):
+    '''
+    Pretends to simulate: systems and states are just counters and every measurement
+    is a coin toss.
+    '''
+    def __init__(self, bits):
+        self.bits = bits
+        self.next_id = 0
+
+    def new_id(self):
+        self.next_id += 1
+        return self.next_id
+
+    def measure(self, description, delimiter):
+        # Count the lines that look like measurements, whatever the dialect
+        lines = description.split(chr(delimiter)) if delimiter else [description]
+        count = sum(1 for line in lines
+                    if line.strip().lower().split(' ')[0] in ('m', 'measure'))
+        return ''.join(random.choice('01') for _ in range(count or self.bits))
+
+    def call(self, method, params):
+        if method == 'get_uniform_integer':
+            return [random.randint(params[1], params[2]) for _ in range(params[0])]
+        if method == 'get_uniform_real':
+            return [random.uniform(params[1], params[2]) for _ in range(params[0])]
+        if method == 'get_weighted_integer':
+            return random.choices(range(len(params[1])), params[1], k=params[0])
+        if method in ('create_system', 'create_state'):
+            return self.new_id()
+        if method in ('delete_system', 'delete_state', 'modify_state'):
+            return True
+        if method == 'measure_state':
+            return self.measure(params[3], params[4])
+        if method == 'compute_result':
+            return self.measure(params[2], params[3])
+        raise KeyError(method)
+
+def decode_parameters(shape, payload):
+    params = []
+    offset = 0
+    for kind in shape:
+        if kind in 'Qqd':
+            params.append(struct.unpack_from('<' + kind, payload, offset)[0])
+            offset += 8
+        elif kind == 'c':
+            params.append(payload[offset])
+            offset += 1
+        elif kind == 's':
+            size = struct.unpack_from('<I', payload, offset)[0]
+            params.append(payload[offset+4:offset+4+size].decode('utf-8'))
+            offset += 4 + size
+        elif kind == 'D':
+            count = struct.unpack_from('<I', payload, offset)[0]
+            params.append(list(struct.unpack_from('<%dd' % count, payload, offset+4)))
+            offset += 4 + 8*count
+    return params
+
+def encode_result(shape, result):
+    if shape == '?':
+        return struct.pack('<?', result)
+    if shape == 'Q':
+        return struct.pack('<Q', result)
+    if shape in ('Q*', 'q*', 'D'):
+        kind = 'd' if shape == 'D' else shape[0]
+        return struct.pack('<I%d%s' % (len(result), kind), len(result), *result)
+    if shape == 'b':
+        # The first measurement goes into the most significant bit of the first byte
+        packed = bytearray((len(result) + 7)//8)
+        for i, bit in enumerate(result):
+            if bit == '1':
+                packed[i//8] |= 0x80 >> (i%8)
+        return struct.pack('<I', len(result)) + bytes(packed)
+    raise ValueError(shape)
+
+def handle_binary(simulator, message):
+    magic, version, method_id, flags, size = HEADER.unpack_from(message)
+    method = METHODS[method_id] if method_id < len(METHODS) else None
+    try:
+        if version != BINARY_VERSION or size != len(message) - HEADER.size or not method:
+            raise ValueError('bad frame')
+        params = decode_parameters(PARAMETERS[method], message[HEADER.size:])
+        payload = encode_result(RESULTS[method], simulator.call(method, params))
+        flags = 0
+    except Exception as e:
+        payload = str(e).encode('utf-8')
+        payload = struct.pack('<I', len(payload)) + payload
+        flags = BINARY_FLAG_ERROR
+    return HEADER.pack(BINARY_MAGIC, BINARY_VERSION, method_id, flags, len(payload)) + payload
+
+def handle_json(simulator, message, binary):
+    try:
+        request = json.loads(message.rstrip(b'\0').decode('utf-8'))
+        method, params = request['method'], request['parameters']
+        if method == 'negotiate':
+            if not binary:
+                raise KeyError(method)
+            result = params[0] == 'binary' and params[1] == BINARY_VERSION
+        else:
+            result = simulator.call(method, params)
+        reply = {'result': result}
+    except Exception as e:
+        reply = {'error': True, 'message': str(e)}
+    # The dispatcher parses in situ, so we send a null terminator like it does
+    return json.dumps(reply).encode('utf-8') + b'\0'
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(prog='sabot_stub', description='stand-in simulator')
+
+    parser.add_argument(
+            '-e',
+            '--endpoint',
+            metavar='endpoint',
+            dest='endpoint',
+            type=str,
+            required=True,
+            help='Endpoint to bind to, e.g. tcp://127.0.0.1:5000.'
+        )
+    parser.add_argument(
+            '-b',
+            '--bits',
+            metavar='bits',
+            dest='bits',
+            type=int,
+            default=1,
+            help='Number of bits measured by circuits without recognizable measurements.'
+        )
+    parser.add_argument(
+            '-j',
+            '--json-only',
+            dest='binary',
+            action='store_false',
+            help='Decline to negotiate the binary encoding, like an older simulator.'
+        )
+    args = parser.parse_args()
+
+    simulator = Simulator(args.bits)
+    context = zmq.Context(1)
+    socket = context.socket(zmq.REP)
+    socket.bind(args.endpoint)
+
+    while True:
+        message = socket.recv()
+        if args.binary and message and message[0] == BINARY_MAGIC:
+            socket.send(handle_binary(simulator, message))
+        else:
+            socket.send(handle_json(simulator, message, args.binary))